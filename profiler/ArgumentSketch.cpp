@@ -0,0 +1,569 @@
+#include "ArgumentSketch.h"
+#include "MemoryBudget.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// Nesting beyond this in a signature is not worth following.
+static const int MaxTypeDepth = 16;
+
+// UTF-16 code units a string value hashes for its key.
+static const size_t HashedLength = 1024;
+
+// Advances past one type, setting `element` to what it decodes as. Returns
+// false when the type cannot be skipped over.
+static bool ReadType(PCCOR_SIGNATURE& cursor, PCCOR_SIGNATURE end, CorElementType& element, int depth) {
+    if (cursor >= end || depth > MaxTypeDepth) {
+        return false;
+    }
+    CorElementType type = (CorElementType) *cursor++;
+    CorElementType inner;
+    element = ELEMENT_TYPE_END;
+    switch (type) {
+        case ELEMENT_TYPE_BOOLEAN:
+        case ELEMENT_TYPE_CHAR:
+        case ELEMENT_TYPE_I1:
+        case ELEMENT_TYPE_U1:
+        case ELEMENT_TYPE_I2:
+        case ELEMENT_TYPE_U2:
+        case ELEMENT_TYPE_I4:
+        case ELEMENT_TYPE_U4:
+        case ELEMENT_TYPE_I8:
+        case ELEMENT_TYPE_U8:
+        case ELEMENT_TYPE_R4:
+        case ELEMENT_TYPE_R8:
+        case ELEMENT_TYPE_I:
+        case ELEMENT_TYPE_U:
+        case ELEMENT_TYPE_STRING:
+            element = type;
+            return true;
+        case ELEMENT_TYPE_VOID:
+        case ELEMENT_TYPE_OBJECT:
+        case ELEMENT_TYPE_TYPEDBYREF:
+            return true;
+        case ELEMENT_TYPE_CLASS:
+        case ELEMENT_TYPE_VALUETYPE:
+            CorSigUncompressToken(cursor);
+            return cursor <= end;
+        case ELEMENT_TYPE_VAR:
+        case ELEMENT_TYPE_MVAR:
+            CorSigUncompressData(cursor);
+            return cursor <= end;
+        case ELEMENT_TYPE_PTR:
+        case ELEMENT_TYPE_BYREF:
+        case ELEMENT_TYPE_SZARRAY:
+        case ELEMENT_TYPE_PINNED:
+            // The argument holds an address, not the value.
+            return ReadType(cursor, end, inner, depth + 1);
+        case ELEMENT_TYPE_CMOD_REQD:
+        case ELEMENT_TYPE_CMOD_OPT:
+            // Modifiers do not change how the value is laid out.
+            CorSigUncompressToken(cursor);
+            return ReadType(cursor, end, element, depth + 1);
+        case ELEMENT_TYPE_GENERICINST: {
+            if (!ReadType(cursor, end, inner, depth + 1)) {
+                return false;
+            }
+            ULONG count = CorSigUncompressData(cursor);
+            for (ULONG i = 0; i < count; i++) {
+                if (!ReadType(cursor, end, inner, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ELEMENT_TYPE_ARRAY: {
+            if (!ReadType(cursor, end, inner, depth + 1)) {
+                return false;
+            }
+            CorSigUncompressData(cursor);
+            ULONG sizes = CorSigUncompressData(cursor);
+            for (ULONG i = 0; i < sizes; i++) {
+                CorSigUncompressData(cursor);
+            }
+            ULONG bounds = CorSigUncompressData(cursor);
+            for (ULONG i = 0; i < bounds; i++) {
+                CorSigUncompressData(cursor);
+            }
+            return cursor <= end;
+        }
+        default:
+            // Function pointers, varargs sentinels and anything newer.
+            return false;
+    }
+}
+
+bool ParseArgumentTypes(PCCOR_SIGNATURE signature, ULONG size, bool& hasThis, std::vector<CorElementType>& types) {
+    PCCOR_SIGNATURE cursor = signature;
+    PCCOR_SIGNATURE end = signature + size;
+    if (cursor >= end) {
+        return false;
+    }
+    ULONG callingConvention = *cursor++;
+    hasThis = (callingConvention & IMAGE_CEE_CS_CALLCONV_HASTHIS) != 0;
+    if ((callingConvention & IMAGE_CEE_CS_CALLCONV_GENERIC) != 0) {
+        CorSigUncompressData(cursor);
+    }
+    ULONG count = CorSigUncompressData(cursor);
+
+    CorElementType element;
+    if (!ReadType(cursor, end, element, 0)) {
+        return false;
+    }
+
+    types.clear();
+    for (ULONG i = 0; i < count; i++) {
+        if (!ReadType(cursor, end, element, 0)) {
+            return false;
+        }
+        types.push_back(element);
+    }
+    return true;
+}
+
+// Slots in the index of a TopK of `capacity`: a power of two, at most half
+// full.
+static size_t SlotCount(size_t capacity) {
+    size_t count = 2;
+    while (count < 2 * capacity) {
+        count <<= 1;
+    }
+    return count;
+}
+
+TopK::TopK(size_t capacity) :
+    capacity(capacity),
+    size(0),
+    entries(new Entry[capacity]),
+    links(new Link[capacity]),
+    buckets(new Bucket[capacity + 1]),
+    smallest(-1),
+    freeBuckets(0),
+    slots(new int32_t[SlotCount(capacity)]),
+    slotMask(SlotCount(capacity) - 1)
+{
+    for (size_t i = 0; i <= capacity; i++) {
+        this->buckets[i].next = i < capacity ? (int32_t) i + 1 : -1;
+    }
+    std::fill(this->slots, this->slots + this->slotMask + 1, -1);
+}
+
+TopK::~TopK()
+{
+    delete[] this->entries;
+    delete[] this->links;
+    delete[] this->buckets;
+    delete[] this->slots;
+}
+
+size_t TopK::Footprint(size_t capacity) {
+    return sizeof(TopK)
+        + capacity * (sizeof(Entry) + sizeof(Link))
+        + (capacity + 1) * sizeof(Bucket)
+        + SlotCount(capacity) * sizeof(int32_t);
+}
+
+size_t TopK::Hash(uint64_t key) const {
+    uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    return (size_t) (hash >> 32) & this->slotMask;
+}
+
+int32_t TopK::Find(uint64_t key) const {
+    for (size_t slot = this->Hash(key); ; slot = (slot + 1) & this->slotMask) {
+        int32_t entry = this->slots[slot];
+        if (entry < 0 || this->entries[entry].key == key) {
+            return entry;
+        }
+    }
+}
+
+void TopK::Index(uint64_t key, int32_t entry) {
+    size_t slot = this->Hash(key);
+    while (this->slots[slot] >= 0) {
+        slot = (slot + 1) & this->slotMask;
+    }
+    this->slots[slot] = entry;
+}
+
+void TopK::Unindex(uint64_t key) {
+    size_t hole = this->Hash(key);
+    while (this->entries[this->slots[hole]].key != key) {
+        hole = (hole + 1) & this->slotMask;
+    }
+    // Shifts back the entries after the hole that probed past it, so that
+    // lookups need no tombstones.
+    for (size_t slot = (hole + 1) & this->slotMask; this->slots[slot] >= 0; slot = (slot + 1) & this->slotMask) {
+        size_t home = this->Hash(this->entries[this->slots[slot]].key);
+        if (((slot - home) & this->slotMask) >= ((slot - hole) & this->slotMask)) {
+            this->slots[hole] = this->slots[slot];
+            hole = slot;
+        }
+    }
+    this->slots[hole] = -1;
+}
+
+int32_t TopK::NewBucket(uint64_t count, int32_t previous) {
+    int32_t bucket = this->freeBuckets;
+    this->freeBuckets = this->buckets[bucket].next;
+    Bucket& created = this->buckets[bucket];
+    created.count = count;
+    created.first = -1;
+    created.previous = previous;
+    created.next = previous < 0 ? this->smallest : this->buckets[previous].next;
+    if (created.next >= 0) {
+        this->buckets[created.next].previous = bucket;
+    }
+    if (previous < 0) {
+        this->smallest = bucket;
+    } else {
+        this->buckets[previous].next = bucket;
+    }
+    return bucket;
+}
+
+void TopK::Attach(int32_t entry, int32_t bucket) {
+    Link& link = this->links[entry];
+    link.bucket = bucket;
+    link.previous = -1;
+    link.next = this->buckets[bucket].first;
+    if (link.next >= 0) {
+        this->links[link.next].previous = entry;
+    }
+    this->buckets[bucket].first = entry;
+    this->entries[entry].count = this->buckets[bucket].count;
+}
+
+void TopK::Detach(int32_t entry) {
+    Link& link = this->links[entry];
+    Bucket& bucket = this->buckets[link.bucket];
+    if (link.previous >= 0) {
+        this->links[link.previous].next = link.next;
+    } else {
+        bucket.first = link.next;
+    }
+    if (link.next >= 0) {
+        this->links[link.next].previous = link.previous;
+    }
+    if (bucket.first >= 0) {
+        return;
+    }
+    // The bucket is empty, and goes back to the free list.
+    if (bucket.previous >= 0) {
+        this->buckets[bucket.previous].next = bucket.next;
+    } else {
+        this->smallest = bucket.next;
+    }
+    if (bucket.next >= 0) {
+        this->buckets[bucket.next].previous = bucket.previous;
+    }
+    bucket.next = this->freeBuckets;
+    this->freeBuckets = link.bucket;
+}
+
+void TopK::Increment(int32_t entry) {
+    int32_t current = this->links[entry].bucket;
+    uint64_t count = this->buckets[current].count + 1;
+    int32_t next = this->buckets[current].next;
+    if (next >= 0 && this->buckets[next].count == count) {
+        this->Detach(entry);
+        this->Attach(entry, next);
+    } else if (this->buckets[current].first == entry && this->links[entry].next < 0) {
+        // Alone in its bucket, which can take the new count in place.
+        this->buckets[current].count = count;
+        this->entries[entry].count = count;
+    } else {
+        int32_t bucket = this->NewBucket(count, current);
+        this->Detach(entry);
+        this->Attach(entry, bucket);
+    }
+}
+
+TopK::Entry* TopK::Add(uint64_t key) {
+    int32_t entry = this->Find(key);
+    if (entry >= 0) {
+        this->Increment(entry);
+        return nullptr;
+    }
+
+    if (this->size < this->capacity) {
+        entry = (int32_t) this->size++;
+        int32_t bucket = this->smallest;
+        if (bucket < 0 || this->buckets[bucket].count != 1) {
+            bucket = this->NewBucket(1, -1);
+        }
+        this->Attach(entry, bucket);
+        this->entries[entry].error = 0;
+    } else {
+        entry = this->buckets[this->smallest].first;
+        this->Unindex(this->entries[entry].key);
+        this->entries[entry].error = this->entries[entry].count;
+        this->Increment(entry);
+    }
+    Entry& taken = this->entries[entry];
+    taken.key = key;
+    taken.length = 0;
+    this->Index(key, entry);
+    return &taken;
+}
+
+std::vector<TopK::Entry> TopK::List() const {
+    std::vector<Entry> sorted(this->entries, this->entries + this->size);
+    std::sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b) {
+        return a.count > b.count;
+    });
+    return sorted;
+}
+
+static ArgumentType Classify(CorElementType element, size_t& width) {
+    switch (element) {
+        case ELEMENT_TYPE_BOOLEAN: width = 1; return ArgumentType::Bool;
+        case ELEMENT_TYPE_CHAR: width = 2; return ArgumentType::Char;
+        case ELEMENT_TYPE_I1: width = 1; return ArgumentType::Signed;
+        case ELEMENT_TYPE_U1: width = 1; return ArgumentType::Unsigned;
+        case ELEMENT_TYPE_I2: width = 2; return ArgumentType::Signed;
+        case ELEMENT_TYPE_U2: width = 2; return ArgumentType::Unsigned;
+        case ELEMENT_TYPE_I4: width = 4; return ArgumentType::Signed;
+        case ELEMENT_TYPE_U4: width = 4; return ArgumentType::Unsigned;
+        case ELEMENT_TYPE_I8: width = 8; return ArgumentType::Signed;
+        case ELEMENT_TYPE_U8: width = 8; return ArgumentType::Unsigned;
+        case ELEMENT_TYPE_I: width = sizeof(intptr_t); return ArgumentType::Signed;
+        case ELEMENT_TYPE_U: width = sizeof(uintptr_t); return ArgumentType::Unsigned;
+        case ELEMENT_TYPE_R4: width = 4; return ArgumentType::Float;
+        case ELEMENT_TYPE_R8: width = 8; return ArgumentType::Float;
+        case ELEMENT_TYPE_STRING: width = sizeof(ObjectID); return ArgumentType::String;
+        default: width = 0; return ArgumentType::Skipped;
+    }
+}
+
+ArgumentSketch::ArgumentSketch(CorElementType element, size_t capacity) :
+    count(0),
+    top(capacity),
+    negatives(0)
+{
+    this->type = Classify(element, this->width);
+}
+
+ArgumentSketches::ArgumentSketches() : hasThis(false), parameterCount(0), footprint(0)
+{
+}
+
+ArgumentSketches* ArgumentSketches::Create(PCCOR_SIGNATURE signature, ULONG size, size_t capacity) {
+    bool hasThis = false;
+    std::vector<CorElementType> types;
+    if (!ParseArgumentTypes(signature, size, hasThis, types)) {
+        return nullptr;
+    }
+
+    size_t sketched = 0;
+    for (size_t i = 0; i < types.size() && i < MaxArguments; i++) {
+        if (types[i] != ELEMENT_TYPE_END) {
+            sketched++;
+        }
+    }
+    if (sketched == 0) {
+        return nullptr;
+    }
+
+    size_t footprint = sizeof(ArgumentSketches) + sketched * (sizeof(ArgumentSketch) + TopK::Footprint(capacity));
+    if (!GetMemoryBudget().TryReserve(footprint)) {
+        return nullptr;
+    }
+
+    ArgumentSketches* sketches = new ArgumentSketches();
+    sketches->hasThis = hasThis;
+    sketches->parameterCount = types.size();
+    sketches->footprint = footprint;
+    for (size_t i = 0; i < types.size() && i < MaxArguments; i++) {
+        sketches->arguments.push_back(
+                types[i] == ELEMENT_TYPE_END ? nullptr : new ArgumentSketch(types[i], capacity)
+        );
+    }
+    return sketches;
+}
+
+ArgumentSketches::~ArgumentSketches()
+{
+    for (ArgumentSketch* sketch : this->arguments) {
+        delete sketch;
+    }
+    GetMemoryBudget().Release(this->footprint);
+}
+
+static void AppendLabelByte(std::string& label, uint8_t byte) {
+    // Escapes what would break the profile's `key=value` and list syntax.
+    if (byte > ' ' && byte < 0x7f && byte != '%' && byte != ',' && byte != ':' && byte != '=') {
+        label.push_back((char) byte);
+        return;
+    }
+    char escaped[4];
+    snprintf(escaped, sizeof(escaped), "%%%02X", byte);
+    label += escaped;
+}
+
+static void AppendLabelChar(std::string& label, uint16_t unit) {
+    if (unit < 0x80) {
+        AppendLabelByte(label, (uint8_t) unit);
+    } else if (unit < 0x800) {
+        AppendLabelByte(label, (uint8_t) (0xc0 | unit >> 6));
+        AppendLabelByte(label, (uint8_t) (0x80 | (unit & 0x3f)));
+    } else {
+        // Surrogates come out one unit at a time; the label is only a hint.
+        AppendLabelByte(label, (uint8_t) (0xe0 | unit >> 12));
+        AppendLabelByte(label, (uint8_t) (0x80 | (unit >> 6 & 0x3f)));
+        AppendLabelByte(label, (uint8_t) (0x80 | (unit & 0x3f)));
+    }
+}
+
+// What one argument of a call adds to its TopK: the key, and for strings the
+// characters to keep should the key take a slot.
+struct Sample
+{
+    uint64_t key;
+    const uint16_t* chars;
+    uint32_t length;
+};
+
+static void SampleString(const uint8_t* value, const StringLayout& layout, Sample& sample) {
+    ObjectID object;
+    memcpy(&object, value, sizeof(object));
+    sample.chars = nullptr;
+    sample.length = 0;
+    if (object == 0) {
+        sample.key = 0;
+        return;
+    }
+
+    // Objects cannot move while the thread is in a hook.
+    uint32_t length;
+    memcpy(&length, (const uint8_t*) object + layout.lengthOffset, sizeof(length));
+    const uint16_t* chars = (const uint16_t*) ((const uint8_t*) object + layout.bufferOffset);
+
+    // FNV-1a over the length and the leading characters.
+    uint64_t hash = 0xcbf29ce484222325ull ^ length;
+    for (uint32_t i = 0; i < length && i < HashedLength; i++) {
+        hash = (hash ^ chars[i]) * 0x100000001b3ull;
+    }
+    // 0 stands for null.
+    sample.key = hash | 1;
+    sample.chars = chars;
+    sample.length = length;
+}
+
+static void SampleNumber(ArgumentSketch& sketch, const uint8_t* value, Sample& sample) {
+    uint64_t bits = 0;
+    memcpy(&bits, value, sketch.width);
+
+    if (sketch.type == ArgumentType::Signed) {
+        int shift = 64 - 8 * (int) sketch.width;
+        int64_t number = (int64_t) (bits << shift) >> shift;
+        if (number < 0) {
+            sketch.negatives.fetch_add(1, std::memory_order_relaxed);
+        }
+        sketch.magnitudes.Record(number < 0 ? 0 - (uint64_t) number : (uint64_t) number);
+    } else if (sketch.type == ArgumentType::Unsigned) {
+        sketch.magnitudes.Record(bits);
+    } else if (sketch.type == ArgumentType::Bool) {
+        bits = bits != 0 ? 1 : 0;
+    }
+
+    // The key is the value itself, so Label can name it.
+    sample.key = bits;
+    sample.chars = nullptr;
+    sample.length = 0;
+}
+
+std::string ArgumentSketch::Label(const TopK::Entry& entry) const {
+    std::string label;
+    switch (this->type) {
+        case ArgumentType::Signed: {
+            int shift = 64 - 8 * (int) this->width;
+            return std::to_string((int64_t) (entry.key << shift) >> shift);
+        }
+        case ArgumentType::Unsigned:
+            return std::to_string(entry.key);
+        case ArgumentType::Float: {
+            double number;
+            if (this->width == sizeof(float)) {
+                float single;
+                uint32_t bits = (uint32_t) entry.key;
+                memcpy(&single, &bits, sizeof(single));
+                number = single;
+            } else {
+                memcpy(&number, &entry.key, sizeof(number));
+            }
+            char text[32];
+            snprintf(text, sizeof(text), "%g", number);
+            return text;
+        }
+        case ArgumentType::Bool:
+            return entry.key != 0 ? "true" : "false";
+        case ArgumentType::Char:
+            AppendLabelChar(label, (uint16_t) entry.key);
+            return label;
+        case ArgumentType::String:
+            if (entry.key == 0) {
+                return "null";
+            }
+            for (uint32_t i = 0; i < entry.length && i < TopK::TextLength; i++) {
+                AppendLabelChar(label, entry.text[i]);
+            }
+            if (entry.length > TopK::TextLength) {
+                label += "...";
+            }
+            return label;
+        default:
+            return label;
+    }
+}
+
+void ArgumentSketches::Record(const COR_PRF_FUNCTION_ARGUMENT_INFO& info, const StringLayout& layout) {
+    size_t first = this->hasThis ? 1 : 0;
+    if (info.numRanges != first + this->parameterCount) {
+        return;
+    }
+    // Keys are worked out first, so that the lock is taken once per call
+    // and held only for the TopK updates.
+    Sample samples[MaxArguments];
+    bool sampled[MaxArguments];
+    for (size_t i = 0; i < this->arguments.size(); i++) {
+        ArgumentSketch* sketch = this->arguments[i];
+        const COR_PRF_FUNCTION_ARGUMENT_RANGE& range = info.ranges[first + i];
+        sampled[i] = sketch != nullptr && range.length >= sketch->width;
+        if (!sampled[i]) {
+            continue;
+        }
+        sketch->count.fetch_add(1, std::memory_order_relaxed);
+        const uint8_t* value = (const uint8_t*) range.startAddress;
+        if (sketch->type == ArgumentType::String) {
+            SampleString(value, layout, samples[i]);
+        } else {
+            SampleNumber(*sketch, value, samples[i]);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (size_t i = 0; i < this->arguments.size(); i++) {
+        if (!sampled[i]) {
+            continue;
+        }
+        TopK::Entry* taken = this->arguments[i]->top.Add(samples[i].key);
+        if (taken != nullptr && samples[i].chars != nullptr) {
+            uint32_t length = samples[i].length;
+            taken->length = length;
+            size_t kept = length < TopK::TextLength ? length : TopK::TextLength;
+            memcpy(taken->text, samples[i].chars, kept * sizeof(uint16_t));
+        }
+    }
+}
+
+const char* ArgumentTypeName(ArgumentType type) {
+    switch (type) {
+        case ArgumentType::Signed: return "signed";
+        case ArgumentType::Unsigned: return "unsigned";
+        case ArgumentType::Float: return "float";
+        case ArgumentType::Bool: return "bool";
+        case ArgumentType::Char: return "char";
+        case ArgumentType::String: return "string";
+        default: return "skipped";
+    }
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "Histogram.h"
+
+// How an argument is decoded, from its type in the method signature.
+enum class ArgumentType : uint8_t
+{
+    // Not decoded: structs, arrays, objects other than strings, ...
+    Skipped,
+    Signed,
+    Unsigned,
+    Float,
+    Bool,
+    Char,
+    String,
+};
+
+// Reads the parameter types of a MethodDef signature, `this` excluded, as
+// the ELEMENT_TYPE of primitives and strings and ELEMENT_TYPE_END for
+// anything else. Returns false for signatures the sketches do not handle,
+// such as varargs.
+bool ParseArgumentTypes(PCCOR_SIGNATURE signature, ULONG size, bool& hasThis, std::vector<CorElementType>& types);
+
+// Space-Saving top-k: keeps `capacity` counters, and a key that finds them
+// all taken replaces the smallest one, inheriting its count as `error`. Any
+// key seen more than total/capacity times is guaranteed to be kept, with a
+// count at most `error` too high.
+//
+// Laid out as a Stream-Summary, so that an update is constant time: a hash
+// index finds a key's entry, and entries hang off a list of buckets of equal
+// count, smallest first. Nothing is allocated after construction, and
+// entries keep raw values for labels to be built when the profile is
+// written. Not thread-safe.
+class TopK
+{
+public:
+    // UTF-16 code units of a string value kept for its label.
+    static const size_t TextLength = 48;
+
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t count;
+        uint64_t error;
+        // String values only: the full length and the leading characters.
+        uint32_t length;
+        uint16_t text[TextLength];
+    };
+
+    TopK(const TopK&) = delete;
+    TopK& operator= (const TopK&) = delete;
+
+    explicit TopK(size_t capacity);
+    ~TopK();
+
+    // Bytes a TopK of `capacity` takes.
+    static size_t Footprint(size_t capacity);
+
+    // Counts one occurrence of `key`. Returns its entry when the key has just
+    // taken a slot, for the caller to fill in `length` and `text`, and
+    // nullptr otherwise.
+    Entry* Add(uint64_t key);
+
+    // Highest counts first.
+    std::vector<Entry> List() const;
+
+private:
+    struct Bucket
+    {
+        uint64_t count;
+        int32_t first;
+        int32_t previous;
+        int32_t next;
+    };
+
+    struct Link
+    {
+        int32_t bucket;
+        int32_t previous;
+        int32_t next;
+    };
+
+    size_t capacity;
+    size_t size;
+    Entry* entries;
+    Link* links;
+    // One more than `capacity`, as an increment takes its new bucket before
+    // it frees the old one. Free buckets are chained through `next`.
+    Bucket* buckets;
+    int32_t smallest;
+    int32_t freeBuckets;
+    // Entry of each key by hash, with linear probing; -1 when empty.
+    int32_t* slots;
+    size_t slotMask;
+
+    size_t Hash(uint64_t key) const;
+    int32_t Find(uint64_t key) const;
+    void Index(uint64_t key, int32_t entry);
+    void Unindex(uint64_t key);
+    int32_t NewBucket(uint64_t count, int32_t previous);
+    void Attach(int32_t entry, int32_t bucket);
+    void Detach(int32_t entry);
+    void Increment(int32_t entry);
+};
+
+// Where a System.String keeps its length and characters.
+struct StringLayout
+{
+    ULONG lengthOffset;
+    ULONG bufferOffset;
+};
+
+// What the values of one argument looked like across calls.
+struct ArgumentSketch
+{
+    ArgumentSketch(CorElementType element, size_t capacity);
+
+    ArgumentType type;
+    // Bytes the value takes in its argument range.
+    size_t width;
+    std::atomic<uint64_t> count;
+
+    // Guarded by the mutex of the ArgumentSketches it belongs to.
+    TopK top;
+
+    // Names the value of one of `top`'s entries.
+    std::string Label(const TopK::Entry& entry) const;
+
+    // Integer arguments only: the distribution of their magnitudes, and how
+    // many of them were negative.
+    LatencyHistogram magnitudes;
+    std::atomic<uint64_t> negatives;
+};
+
+// The sketches of one method's arguments, built from its signature when the
+// method is hooked with `argument_top_k` set. Constant memory per method, so
+// nothing grows with the number of calls.
+class ArgumentSketches
+{
+public:
+    // Arguments past this many are not sketched.
+    static const size_t MaxArguments = 8;
+
+    // Returns nullptr when no argument can be decoded or the memory budget
+    // has no room.
+    static ArgumentSketches* Create(PCCOR_SIGNATURE signature, ULONG size, size_t capacity);
+    ~ArgumentSketches();
+
+    // Feeds the arguments of one call, from GetFunctionEnter3Info. Calls whose
+    // ranges do not line up with the signature are ignored.
+    void Record(const COR_PRF_FUNCTION_ARGUMENT_INFO& info, const StringLayout& layout);
+
+    // One sketch per parameter, nullptr for those that are not decoded.
+    std::vector<ArgumentSketch*> arguments;
+    // Guards the `top` of every argument; taken once per call, for a few
+    // index and list updates each.
+    std::mutex mutex;
+
+private:
+    ArgumentSketches();
+
+    bool hasThis;
+    size_t parameterCount;
+    size_t footprint;
+};
+
+// Names an ArgumentType in the profile output.
+const char* ArgumentTypeName(ArgumentType type);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Monotonic timestamp in nanoseconds, used for all latency measurements.
+inline uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
@@ -0,0 +1,266 @@
+#include "Config.h"
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+static const char* const Keys[] = {
+    "report_socket",
+    "memory_limit",
+    "trace_path",
+    "trace_format",
+    "trace_compress_threads",
+    "trace_detail",
+    "filter",
+    "waits",
+    "wait_threshold_us",
+    "interop",
+    "profile_path",
+    "detach_after",
+    "coverage_path",
+    "tests",
+    "test_attributes",
+    "argument_top_k",
+    "triggers",
+    "trigger_interval_s",
+    "trigger_capture_s",
+    "trigger_idle_detail",
+    "dynamic_methods",
+    "object_lifetimes",
+    "startup",
+    "hardware_counters",
+    "aggregator_socket",
+    "aggregator_interval_s",
+};
+
+static bool ParseBool(const std::string& value, bool& flag) {
+    if (value == "1" || value == "true" || value == "on") {
+        flag = true;
+    } else if (value == "0" || value == "false" || value == "off") {
+        flag = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool ParseSeconds(const std::string& value, int& seconds) {
+    char* end = nullptr;
+    errno = 0;
+    long number = strtol(value.c_str(), &end, 10);
+    if (end == value.c_str() || *end != '\0' || errno != 0 || number < 0 || number > INT_MAX) {
+        return false;
+    }
+    seconds = (int) number;
+    return true;
+}
+
+static bool ParseSize(const std::string& value, size_t& size) {
+    char* end = nullptr;
+    unsigned long long number = strtoull(value.c_str(), &end, 10);
+    if (end == value.c_str()) {
+        return false;
+    }
+    switch (toupper(*end)) {
+        case 'G': number <<= 10; // fall through
+        case 'M': number <<= 10; // fall through
+        case 'K': number <<= 10; end++; break;
+        default: break;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    size = (size_t) number;
+    return true;
+}
+
+Config::Config() :
+    memoryLimit(0),
+    traceFormat("text"),
+    traceCompressThreads(2),
+    traceDetail("arguments"),
+    filter("foo!foo.Program::foo"),
+    waits(false),
+    waitThresholdUs(1000),
+    interop(false),
+    detachAfter(0),
+    testAttributes(
+        "Xunit.FactAttribute;"
+        "Xunit.TheoryAttribute;"
+        "NUnit.Framework.TestAttribute;"
+        "NUnit.Framework.TestCaseAttribute;"
+        "Microsoft.VisualStudio.TestTools.UnitTesting.TestMethodAttribute"
+    ),
+    argumentTopK(0),
+    triggerIntervalSeconds(10),
+    triggerCaptureSeconds(30),
+    triggerIdleDetail("counts"),
+    dynamicMethods(false),
+    objectLifetimes(false),
+    hardwareCounters(false),
+    aggregatorIntervalSeconds(10)
+{
+}
+
+bool Config::Set(const std::string& key, const std::string& value) {
+    if (key == "report_socket") {
+        this->reportSocket = value;
+    } else if (key == "memory_limit") {
+        if (!ParseSize(value, this->memoryLimit)) {
+            printf("Error: invalid memory_limit %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "trace_path") {
+        this->tracePath = value;
+    } else if (key == "trace_format") {
+        this->traceFormat = value;
+    } else if (key == "trace_compress_threads") {
+        this->traceCompressThreads = atoi(value.c_str());
+        if (this->traceCompressThreads < 1) {
+            printf("Error: invalid trace_compress_threads %s\n", value.c_str());
+            this->traceCompressThreads = 1;
+            return false;
+        }
+    } else if (key == "trace_detail") {
+        if (value != "arguments" && value != "timestamps" && value != "counts") {
+            printf("Error: invalid trace_detail %s\n", value.c_str());
+            return false;
+        }
+        this->traceDetail = value;
+    } else if (key == "filter") {
+        this->filter = value;
+    } else if (key == "waits") {
+        if (!ParseBool(value, this->waits)) {
+            printf("Error: invalid waits %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "wait_threshold_us") {
+        this->waitThresholdUs = atoi(value.c_str());
+        if (this->waitThresholdUs < 0) {
+            printf("Error: invalid wait_threshold_us %s\n", value.c_str());
+            this->waitThresholdUs = 0;
+            return false;
+        }
+    } else if (key == "interop") {
+        if (!ParseBool(value, this->interop)) {
+            printf("Error: invalid interop %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "profile_path") {
+        this->profilePath = value;
+    } else if (key == "detach_after") {
+        if (!ParseSeconds(value, this->detachAfter)) {
+            printf("Error: invalid detach_after %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "coverage_path") {
+        this->coveragePath = value;
+    } else if (key == "tests") {
+        this->tests = value;
+    } else if (key == "test_attributes") {
+        this->testAttributes = value;
+    } else if (key == "argument_top_k") {
+        this->argumentTopK = atoi(value.c_str());
+        if (this->argumentTopK < 0) {
+            printf("Error: invalid argument_top_k %s\n", value.c_str());
+            this->argumentTopK = 0;
+            return false;
+        }
+    } else if (key == "triggers") {
+        this->triggers = value;
+    } else if (key == "trigger_interval_s") {
+        this->triggerIntervalSeconds = atoi(value.c_str());
+        if (this->triggerIntervalSeconds < 1) {
+            printf("Error: invalid trigger_interval_s %s\n", value.c_str());
+            this->triggerIntervalSeconds = 10;
+            return false;
+        }
+    } else if (key == "trigger_capture_s") {
+        this->triggerCaptureSeconds = atoi(value.c_str());
+        if (this->triggerCaptureSeconds < 1) {
+            printf("Error: invalid trigger_capture_s %s\n", value.c_str());
+            this->triggerCaptureSeconds = 30;
+            return false;
+        }
+    } else if (key == "trigger_idle_detail") {
+        if (value != "arguments" && value != "timestamps" && value != "counts") {
+            printf("Error: invalid trigger_idle_detail %s\n", value.c_str());
+            return false;
+        }
+        this->triggerIdleDetail = value;
+    } else if (key == "dynamic_methods") {
+        if (!ParseBool(value, this->dynamicMethods)) {
+            printf("Error: invalid dynamic_methods %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "object_lifetimes") {
+        if (!ParseBool(value, this->objectLifetimes)) {
+            printf("Error: invalid object_lifetimes %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "startup") {
+        this->startup = value;
+    } else if (key == "hardware_counters") {
+        if (!ParseBool(value, this->hardwareCounters)) {
+            printf("Error: invalid hardware_counters %s\n", value.c_str());
+            return false;
+        }
+    } else if (key == "aggregator_socket") {
+        this->aggregatorSocket = value;
+    } else if (key == "aggregator_interval_s") {
+        this->aggregatorIntervalSeconds = atoi(value.c_str());
+        if (this->aggregatorIntervalSeconds < 1) {
+            printf("Error: invalid aggregator_interval_s %s\n", value.c_str());
+            this->aggregatorIntervalSeconds = 10;
+            return false;
+        }
+    } else {
+        printf("Error: unknown profiler setting %s\n", key.c_str());
+        return false;
+    }
+    return true;
+}
+
+Config Config::FromEnvironment() {
+    Config config;
+    for (const char* key : Keys) {
+        std::string name = "PROFILER_";
+        for (const char* c = key; *c != '\0'; c++) {
+            name += (char) toupper(*c);
+        }
+        const char* value = getenv(name.c_str());
+        if (value != nullptr) {
+            config.Set(key, value);
+        }
+    }
+    return config;
+}
+
+Config Config::FromClientData(const void* data, UINT size) {
+    Config config;
+    std::string text(static_cast<const char*>(data), data == nullptr ? 0 : size);
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        // Tolerate a trailing null from C callers and CRLF line ends.
+        while (!line.empty() && (line.back() == '\0' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            printf("Error: invalid profiler setting %s\n", line.c_str());
+            continue;
+        }
+        config.Set(line.substr(0, equals), line.substr(equals + 1));
+    }
+    return config;
+}
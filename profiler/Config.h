@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "cor.h"
+
+// Profiler settings. Each key can be set through a `PROFILER_<KEY>`
+// environment variable, e.g. PROFILER_REPORT_SOCKET for `report_socket`, or,
+// when attaching, through the client data as `key=value` lines.
+struct Config
+{
+    Config();
+
+    // Path of the Unix domain socket serving live aggregates; empty disables it.
+    std::string reportSocket;
+
+    // Bytes all profiler arenas and buffers may hold, with an optional K, M or
+    // G suffix; 0 means unbounded.
+    size_t memoryLimit;
+
+    // Where the trace goes (stdout when empty), as "text", "binary" or
+    // "compressed".
+    std::string tracePath;
+    std::string traceFormat;
+
+    // Worker threads compressing chunks for the "compressed" format.
+    int traceCompressThreads;
+
+    // Most detail the hooks record: "arguments", "timestamps" or "counts".
+    // "counts" disables the trace altogether.
+    std::string traceDetail;
+
+    // Methods to hook, as `;`-separated `Assembly!Namespace.Type::Method`
+    // patterns where `*` matches anything; see MethodFilter.
+    std::string filter;
+
+    // Whether Monitor, SemaphoreSlim and Task waits are hooked, and how long
+    // one has to block, in microseconds, to be recorded as contention.
+    bool waits;
+    int waitThresholdUs;
+
+    // Whether P/Invokes and reverse P/Invokes are counted and timed.
+    bool interop;
+
+    // Where the final profile is written at shutdown or detach; empty
+    // disables it.
+    std::string profilePath;
+
+    // Seconds an attached profiler stays before detaching itself; 0 keeps it
+    // until shutdown.
+    int detachAfter;
+
+    // Where the coverage bitmaps are written at shutdown. Setting it switches
+    // the hooks to coverage mode, which only records whether each method the
+    // filter selects ran, and turns latencies, traces and waits off.
+    std::string coveragePath;
+
+    // Candidate test methods as filter patterns, e.g. `MyApp.Tests!*`, and
+    // the `;`-separated attribute types that make one a test; an empty list
+    // takes every candidate. Each outermost call of a test gets its time,
+    // allocations and GCs; counting allocations slows allocation down. Empty
+    // `tests` disables this.
+    std::string tests;
+    std::string testAttributes;
+
+    // Values kept per argument of each hooked method, whose numeric and
+    // string arguments are then summarized as top values and histograms in
+    // the profile; 0 disables it. Independent of what the trace records.
+    int argumentTopK;
+
+    // Conditions that raise the trace from `trigger_idle_detail` to
+    // `trace_detail` for `trigger_capture_s` seconds, checked every
+    // `trigger_interval_s` seconds; see TriggerCondition. Empty keeps the
+    // trace at `trace_detail` throughout.
+    std::string triggers;
+    int triggerIntervalSeconds;
+    int triggerCaptureSeconds;
+    std::string triggerIdleDetail;
+
+    // Whether dynamic methods get JIT statistics and synthetic names. The
+    // filter hooks them like other methods under the `<Dynamic>` assembly
+    // and type, e.g. `<Dynamic>!*` for all of them.
+    bool dynamicMethods;
+
+    // Whether finalizable objects are counted and timed from being queued
+    // to being finalized, and GC handles counted as they are created and
+    // destroyed, per type. Timing hooks every Finalize method, which indexes
+    // every module as it loads.
+    bool objectLifetimes;
+
+    // Methods whose first call ends startup, e.g. the request handlers of a
+    // service, as a filter. Until then class and assembly loads are timed,
+    // each charged to the load that triggered it, if any. Empty disables it.
+    std::string startup;
+
+    // Whether hooked methods get CPU cycles, instructions, cache misses and
+    // branch misses, callees included, from per-thread perf_event_open
+    // counters read at Enter and Leave. Linux only; each read is a syscall,
+    // so narrow the filter to the methods in question.
+    bool hardwareCounters;
+
+    // Path of the Unix domain socket of a ProfileAggregator, which merges
+    // the profiles of every process pushing to it into one. Snapshots are
+    // pushed every `aggregator_interval_s` seconds and when the profiler
+    // finishes; empty disables it.
+    std::string aggregatorSocket;
+    int aggregatorIntervalSeconds;
+
+    bool Set(const std::string& key, const std::string& value);
+
+    static Config FromEnvironment();
+
+    // Parses the `pvClientData` passed to AttachProfiler.
+    static Config FromClientData(const void* data, UINT size);
+};
@@ -1,214 +1,467 @@
 #include "CorProfiler.h"
 #include "corhlpr.h"
 #include "CComPtr.h"
+#include "Clock.h"
+#include "Metadata.h"
+#include "Overhead.h"
+#include "ThreadState.h"
+#include "TraceFormat.h"
+#include "TraceSink.h"
+#include "TraceWriter.h"
 #include "profiler_pal.h"
-#include <codecvt>
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <locale>
 #include <string>
 
 static CorProfiler* profiler = nullptr;
 
-std::string ToBytes(std::wstring wide) {
-    using convert_type = std::codecvt_utf8<wchar_t>;
-    std::wstring_convert<convert_type, wchar_t> converter;
-    return converter.to_bytes(wide);
-}
+// Set for `coverage_path`: client IDs are then CoverageMap slots, and only
+// the CoverStub enter hook is installed.
+static bool coverageMode = false;
+
+// Set for `hardware_counters`: the hooks read the thread's counters at Enter
+// and Leave.
+static bool hardwareCounters = false;
+
+// Managed entry points that block, hooked when `waits` is on. The
+// Monitor.Enter(object) overload is an FCall that is never JIT-compiled, but
+// the `lock` statement goes through Enter(object, ref bool), which is.
+static const char* const WaitMethods =
+    "System.Private.CoreLib!System.Threading.Monitor::Enter;"
+    "System.Private.CoreLib!System.Threading.Monitor::TryEnter;"
+    "System.Private.CoreLib!System.Threading.Monitor::Wait;"
+    "System.Private.CoreLib!System.Threading.SemaphoreSlim::Wait;"
+    "System.Private.CoreLib!System.Threading.Tasks.Task::Wait";
+
+// What the finalizer thread calls, hooked when `object_lifetimes` is on.
+static const char* const FinalizerMethods = "*!*::Finalize";
+
+// Fetches the argument ranges of the call `eltInfo` describes into the
+// thread's scratch buffer. Returns nullptr when they cannot be captured within
+// the memory budget. The buffer is asked for its size only when it is too
+// small, so a thread pays for one runtime call once it has grown.
+static COR_PRF_FUNCTION_ARGUMENT_INFO *GetArguments(
+        ThreadState& state,
+        MethodStats *method,
+        COR_PRF_ELT_INFO eltInfo
+) {
+    ICorProfilerInfo3 *info = profiler->corProfilerInfo;
+
+    COR_PRF_FRAME_INFO frameInfo;
+    ULONG capacity = (ULONG) state.ScratchSize();
+    ULONG argumentInfoSize = capacity;
+    COR_PRF_FUNCTION_ARGUMENT_INFO *argumentInfo =
+        capacity == 0 ? nullptr : (COR_PRF_FUNCTION_ARGUMENT_INFO *) state.Scratch(capacity);
 
-std::wstring ToWideString(WCHAR array[], size_t size) {
-    wchar_t* stringWide = new wchar_t[size];
-    for (int i = 0; i < size; i++) {
-        stringWide[i] = (wchar_t) array[i];
+    HRESULT result = info->GetFunctionEnter3Info(
+            method->functionId,
+            eltInfo,
+            &frameInfo,
+            &argumentInfoSize,
+            argumentInfo
+    );
+    if (argumentInfoSize > capacity) {
+        argumentInfo = (COR_PRF_FUNCTION_ARGUMENT_INFO *) state.Scratch(argumentInfoSize);
+        if (argumentInfo == nullptr) {
+            return nullptr;
+        }
+        result = info->GetFunctionEnter3Info(
+                method->functionId,
+                eltInfo,
+                &frameInfo,
+                &argumentInfoSize,
+                argumentInfo
+        );
     }
-    return std::wstring(stringWide);
+    if (FAILED(result)) {
+        printf("Error: GetFunctionEnter3Info %x\n", result);
+        return nullptr;
+    }
+    return argumentInfo;
 }
 
-std::wstring GetModulePath(ICorProfilerInfo2& info, ModuleID moduleId, AssemblyID& assemblyId) {
-    ULONG size;
-    info.GetModuleInfo(moduleId, NULL, 0, &size, nullptr, &assemblyId);
+// The arguments of one Enter, fetched on first use, so that the sketches,
+// the trace and the wait and finalizer lookups share a single fetch.
+struct EnterArguments
+{
+    ThreadState& state;
+    MethodStats *method;
+    COR_PRF_ELT_INFO eltInfo;
+    bool fetched;
+    COR_PRF_FUNCTION_ARGUMENT_INFO *info;
 
-    WCHAR* path = new WCHAR[size];
-    HRESULT result = info.GetModuleInfo(moduleId, NULL, size, &size, path, &assemblyId);
-    if (FAILED(result)) {
-        printf("Error: GetModuleInfo\n");
-        return std::wstring();
+    EnterArguments(ThreadState& state, MethodStats *method, COR_PRF_ELT_INFO eltInfo) :
+        state(state), method(method), eltInfo(eltInfo), fetched(false), info(nullptr)
+    {
     }
 
-    return ToWideString(path, size);
-}
+    // nullptr when they could not be captured.
+    COR_PRF_FUNCTION_ARGUMENT_INFO *Get()
+    {
+        if (!this->fetched) {
+            this->fetched = true;
+            this->info = GetArguments(this->state, this->method, this->eltInfo);
+        }
+        return this->info;
+    }
+};
 
-bool GetFunctionInfo(
-        [in] ICorProfilerInfo2& info,
-        [in] FunctionID funcId,
-        [out] mdToken& functionToken,
-        [out] ModuleID& moduleId,
-        [out] std::wstring& modulePath,
-        [out] AssemblyID& assemblyId
+// Writes an Enter record carrying the raw argument bytes. Returns false when
+// they cannot be captured within the memory budget.
+static bool WriteEnterArguments(
+        ThreadState& state,
+        TraceWriter& trace,
+        MethodStats *method,
+        EnterArguments& enterArguments,
+        uint64_t now
 ) {
-    HRESULT result = info.GetFunctionInfo2(funcId, 0, NULL, &moduleId, &functionToken, 0, NULL, NULL);
-    if (FAILED(result)) {
-        printf("Error: GetFunctionInfo2 %x\n", result);
+    COR_PRF_FUNCTION_ARGUMENT_INFO *argumentInfo = enterArguments.Get();
+    if (argumentInfo == nullptr) {
+        return false;
+    }
+
+    uint32_t size = sizeof(RecordHeader) + sizeof(ArgumentsHeader);
+    for (ULONG i = 0; i < argumentInfo->numRanges; i++) {
+        size += sizeof(RangeHeader) + AlignRecord(argumentInfo->ranges[i].length);
+    }
+
+    uint8_t *record = state.BeginRecord(trace, size);
+    if (record == nullptr) {
         return false;
     }
-    modulePath = GetModulePath(info, moduleId, assemblyId);
+
+    RecordHeader *header = (RecordHeader *) record;
+    header->kind = RecordEnterArguments;
+    header->size = size;
+    header->functionId = method->functionId;
+    header->timestampNs = now;
+
+    ArgumentsHeader *arguments = (ArgumentsHeader *) (record + sizeof(RecordHeader));
+    arguments->numRanges = argumentInfo->numRanges;
+    arguments->totalArgumentSize = argumentInfo->totalArgumentSize;
+
+    uint8_t *cursor = record + sizeof(RecordHeader) + sizeof(ArgumentsHeader);
+    for (ULONG i = 0; i < argumentInfo->numRanges; i++) {
+        COR_PRF_FUNCTION_ARGUMENT_RANGE range = argumentInfo->ranges[i];
+        RangeHeader *rangeHeader = (RangeHeader *) cursor;
+        rangeHeader->startAddress = range.startAddress;
+        rangeHeader->length = range.length;
+        rangeHeader->reserved = 0;
+
+        uint8_t *data = cursor + sizeof(RangeHeader);
+        memcpy(data, (void *) range.startAddress, range.length);
+        memset(data + range.length, 0, AlignRecord(range.length) - range.length);
+        cursor = data + AlignRecord(range.length);
+    }
+
+    state.EndRecord(size);
     return true;
 }
 
-std::wstring GetAssemblyName(ICorProfilerInfo2& info, AssemblyID assemblyId) {
-    ULONG size;
-    info.GetAssemblyInfo(assemblyId, 0, &size, nullptr, NULL, NULL);
-
-    WCHAR *name = new WCHAR[size];
-    HRESULT result = info.GetAssemblyInfo(assemblyId, size, &size, name, NULL, NULL);
-    if (FAILED(result)) {
-        printf("Error: GetAssemblyInfo %x\n", result);
-        return std::wstring();
+static bool WriteEvent(
+        ThreadState& state,
+        TraceWriter& trace,
+        RecordKind kind,
+        MethodStats *method,
+        uint64_t now
+) {
+    uint8_t *record = state.BeginRecord(trace, sizeof(RecordHeader));
+    if (record == nullptr) {
+        return false;
     }
 
-    return ToWideString(name, size);
+    RecordHeader *header = (RecordHeader *) record;
+    header->kind = kind;
+    header->size = sizeof(RecordHeader);
+    header->functionId = method->functionId;
+    header->timestampNs = now;
+
+    state.EndRecord(sizeof(RecordHeader));
+    return true;
 }
 
-std::wstring GetFunctionName(
-        CComPtr<IMetaDataImport2>& metaDataImport2,
-        mdToken functionToken,
-        mdTypeDef& classId
+// Traces one Enter or Leave at the most detail the memory budget currently
+// allows, and counts whatever had to be given up. `arguments` is nullptr
+// for Leave.
+static void TraceEvent(
+        ThreadState& state,
+        RecordKind kind,
+        MethodStats *method,
+        EnterArguments *arguments,
+        uint64_t now
 ) {
-    ULONG size;
-    metaDataImport2->GetMethodProps(
-            functionToken,
-            &classId,
-            nullptr,
-            512,
-            &size,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr
-    );
+    TraceWriter *trace = profiler->trace;
+    if (trace == nullptr) {
+        return;
+    }
 
-    WCHAR *name = new WCHAR[size];
-    HRESULT result = metaDataImport2->GetMethodProps(
-            functionToken,
-            &classId,
-            name,
-            size,
-            &size,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr
-    );
-    if (FAILED(result)) {
-        printf("Error: GetMethodProps %x\n", result);
-        return std::wstring();
+    // Nothing is wanted while armed triggers hold the trace back, so nothing
+    // counts as dropped either.
+    Detail ceiling = trace->Ceiling();
+    if (ceiling == Detail::Counts) {
+        return;
     }
 
-    return ToWideString(name, size);
+    DropStats& drops = profiler->profile.drops;
+    Detail detail = trace->CurrentDetail();
+    bool wantArguments = arguments != nullptr && ceiling == Detail::Arguments;
+
+    if (
+            wantArguments
+            && detail == Detail::Arguments
+            && WriteEnterArguments(state, *trace, method, *arguments, now)
+    ) {
+        return;
+    }
+    if (detail != Detail::Counts && WriteEvent(state, *trace, kind, method, now)) {
+        if (wantArguments) {
+            drops.arguments.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    drops.events.fetch_add(1, std::memory_order_relaxed);
 }
 
-std::wstring GetFunctionType(
-        CComPtr<IMetaDataImport2>& metaDataImport2,
-        mdTypeDef classId
+// The type of the object passed as the first argument, which for the hooked
+// wait methods is the object they block on: the lock for Monitor, `this` for
+// SemaphoreSlim and Task. Looked up at Enter, since a GC during the wait may
+// move the object. For Finalize, it is the object being finalized.
+static ClassID FirstArgumentClass(EnterArguments& arguments) {
+    COR_PRF_FUNCTION_ARGUMENT_INFO *argumentInfo = arguments.Get();
+    if (
+            argumentInfo == nullptr
+            || argumentInfo->numRanges == 0
+            || argumentInfo->ranges[0].length < sizeof(ObjectID)
+    ) {
+        return 0;
+    }
+    ObjectID objectId = *(ObjectID *) argumentInfo->ranges[0].startAddress;
+    ClassID classId = 0;
+    if (objectId == 0 || FAILED(profiler->corProfilerInfo->GetClassFromObject(objectId, &classId))) {
+        return 0;
+    }
+    return classId;
+}
+
+struct CallerWalk
+{
+    FunctionID caller;
+};
+
+static HRESULT __stdcall FindWaitCaller(
+        FunctionID funcId,
+        UINT_PTR ip,
+        COR_PRF_FRAME_INFO frameInfo,
+        ULONG32 contextSize,
+        BYTE context[],
+        void *clientData
 ) {
-    ULONG size;
-    metaDataImport2->GetTypeDefProps(classId, nullptr, 0, &size, nullptr, nullptr);
+    // Skip native frames and the wait methods themselves, which may call
+    // each other, e.g. Task.Wait() calling Task.Wait(int, CancellationToken).
+    if (funcId == 0) {
+        return S_OK;
+    }
+    MethodStats *method = profiler->profile.methods.Find(funcId);
+    if (method != nullptr && method->kind == MethodKind::Wait) {
+        return S_OK;
+    }
+    static_cast<CallerWalk *>(clientData)->caller = funcId;
+    return S_FALSE;
+}
 
-    WCHAR *type = new WCHAR[size];
-    HRESULT result = metaDataImport2->GetTypeDefProps(classId, type, size, &size, nullptr, nullptr);
+static std::string CallerName(FunctionID caller) {
+    if (caller == 0) {
+        return "?";
+    }
+    std::string dynamicName;
+    if (profiler->config.dynamicMethods && profiler->profile.dynamicMethods.Find(caller, dynamicName)) {
+        return dynamicName;
+    }
+    OverheadScope scope(OverheadMetadata);
+    ICorProfilerInfo2& info = *profiler->corProfilerInfo;
+    mdToken token;
+    ModuleID moduleId;
+    HRESULT result = info.GetFunctionInfo2(caller, 0, NULL, &moduleId, &token, 0, NULL, NULL);
     if (FAILED(result)) {
-        printf("Error: GetTypeDefProps %x\n", result);
-        return std::wstring();
+        return "?";
+    }
+    std::shared_ptr<const ModuleInfo> module = profiler->modules.Get(info, moduleId);
+    if (module == nullptr) {
+        return "?";
+    }
+    if (module->IsIndexed(token)) {
+        return module->assemblyName + "!" + module->MethodName(token);
     }
+    return module->assemblyName + "!" + ToBytes(GetTypeAndMethodName(info, caller));
+}
+
+// Files a wait that blocked past the threshold under its call site, found by
+// walking the stack. Only slow waits pay for the walk.
+static void RecordWait(MethodStats *method, ClassID lockClass, uint64_t elapsedNs) {
+    CallerWalk walk;
+    walk.caller = 0;
+    profiler->corProfilerInfo->DoStackSnapshot(0, FindWaitCaller, COR_PRF_SNAPSHOT_DEFAULT, &walk, nullptr, 0);
 
-    return ToWideString(type, size);
+    bool recorded = profiler->profile.waits.Record(method, lockClass, walk.caller, elapsedNs, [&walk]() {
+        return CallerName(walk.caller);
+    });
+    if (!recorded) {
+        profiler->profile.drops.events.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-std::wstring GetTypeAndMethodName(ICorProfilerInfo2& info, FunctionID functionId) {
-    CComPtr<IMetaDataImport2> metaDataImport2;
-    mdMethodDef functionToken;
-    info.GetTokenAndMetaDataFromFunction(
-            functionId,
-            IID_IMetaDataImport,
-            (IUnknown **) &metaDataImport2,
-            &functionToken
-    );
+static void StartTest(ThreadState& state, MethodStats *method, uint64_t now) {
+    TestStats *test = profiler->profile.tests.Get(method);
+    if (test == nullptr) {
+        return;
+    }
+    state.test.stats = test;
+    state.test.depth = state.Depth();
+    state.test.startNs = now;
+    // Every collection includes gen0.
+    state.test.gcCount = profiler->profile.gc.collections[0].load(std::memory_order_relaxed);
+    state.test.gcNs = profiler->profile.gc.totalNs.load(std::memory_order_relaxed);
+    state.test.allocatedBytes = 0;
+    state.test.allocatedObjects = 0;
+}
+
+// Ends the thread's test run once the shadow stack dropped below its frame.
+static void FinishTest(ThreadState& state, uint64_t now, bool failed) {
+    TestStats *test = state.test.stats;
+    if (test == nullptr || state.Depth() >= state.test.depth) {
+        return;
+    }
+    state.test.stats = nullptr;
 
-    mdTypeDef classId;
-    std::wstring name = GetFunctionName(metaDataImport2, functionToken, classId);
-    std::wstring type = GetFunctionType(metaDataImport2, classId);
+    uint64_t elapsed = now - state.test.startNs;
+    test->runs.fetch_add(1, std::memory_order_relaxed);
+    if (failed) {
+        test->failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    test->totalNs.fetch_add(elapsed, std::memory_order_relaxed);
+    AtomicMax(test->maxNs, elapsed);
+    test->allocatedBytes.fetch_add(state.test.allocatedBytes, std::memory_order_relaxed);
+    test->allocatedObjects.fetch_add(state.test.allocatedObjects, std::memory_order_relaxed);
+    GcStats& gc = profiler->profile.gc;
+    test->gcCount.fetch_add(gc.collections[0].load(std::memory_order_relaxed) - state.test.gcCount, std::memory_order_relaxed);
+    test->gcNs.fetch_add(gc.totalNs.load(std::memory_order_relaxed) - state.test.gcNs, std::memory_order_relaxed);
+}
 
-    return type + L"::" + name;
+PROFILER_STUB CoverStub(
+        FunctionIDOrClientID functionIDOrClientID
+) {
+    // A bit test, cheaper than the overhead scope would be.
+    CoverageMap::Cover(functionIDOrClientID.clientID);
 }
 
 PROFILER_STUB EnterStub(
-        FunctionID functionId,
+        FunctionIDOrClientID functionIDOrClientID,
         COR_PRF_ELT_INFO eltInfo
 ) {
-    ICorProfilerInfo3 *info = profiler->corProfilerInfo;
-    printf("EnterStub %lu\n", functionId);
-
-    COR_PRF_FRAME_INFO frameInfo;
-    ULONG argumentInfoSize = 0;
+    OverheadScope scope(OverheadHooks);
+    MethodStats *method = reinterpret_cast<MethodStats *>(functionIDOrClientID.clientID);
+    ThreadState& state = GetThreadState();
+    method->calls.fetch_add(1, std::memory_order_relaxed);
+
+    EnterArguments arguments(state, method, eltInfo);
+    ArgumentSketches *sketches = method->arguments.load(std::memory_order_acquire);
+    if (sketches != nullptr) {
+        COR_PRF_FUNCTION_ARGUMENT_INFO *argumentInfo = arguments.Get();
+        if (argumentInfo != nullptr) {
+            sketches->Record(*argumentInfo, profiler->stringLayout);
+        }
+    }
 
-    info->GetFunctionEnter3Info(
-            functionId,
-            eltInfo,
-            &frameInfo,
-            &argumentInfoSize,
-            nullptr
-    );
+    TraceEvent(state, RecordEnter, method, &arguments, NowNs());
 
-    COR_PRF_FUNCTION_ARGUMENT_INFO *argumentInfo =
-        new COR_PRF_FUNCTION_ARGUMENT_INFO[argumentInfoSize];
+    uintptr_t context = 0;
+    if (method->kind == MethodKind::Wait) {
+        context = FirstArgumentClass(arguments);
+    }
+    if (method->kind == MethodKind::Finalizer) {
+        // Finalize overrides call their base's; only the outermost call was
+        // made by the finalizer thread.
+        MethodStats *caller = state.Top();
+        if (caller == nullptr || caller->kind != MethodKind::Finalizer) {
+            ClassID classId = FirstArgumentClass(arguments);
+            if (classId != 0) {
+                profiler->profile.finalization.Finalized(classId, NowNs());
+            }
+        }
+    }
 
-    HRESULT result = info->GetFunctionEnter3Info(
-            functionId,
-            eltInfo,
-            &frameInfo,
-            &argumentInfoSize,
-            argumentInfo
-    );
-    if (FAILED(result)) {
-        printf("Error: GetFunctionEnter3Info %x", result);
+    if (method->kind == MethodKind::Startup && profiler->profile.startup.Running()) {
+        profiler->profile.startup.End(method, NowNs() - profiler->profile.startNs, state.loadNs);
     }
 
-    printf(
-            "  argumentInfo:\n    numRanges: %u\n    totalArgumentSize: %u\n    ranges:\n",
-            argumentInfo->numRanges,
-            argumentInfo->totalArgumentSize
-    );
+    // Start timing last so tracing is not billed to the method.
+    uint64_t now = NowNs();
+    state.Push(method, now, context);
+    if (hardwareCounters) {
+        CounterSample *sample = state.FrameCounters(state.Depth() - 1);
+        if (sample != nullptr) {
+            state.ReadCounters(*sample);
+        }
+    }
+    if (method->kind == MethodKind::Test && state.test.stats == nullptr) {
+        StartTest(state, method, now);
+    }
+}
 
-    for (uint64_t i = 0; i < argumentInfo->numRanges; i++) {
-        COR_PRF_FUNCTION_ARGUMENT_RANGE range = argumentInfo->ranges[i];
-        printf(
-                "      startAddress: %p\n      length: %u\n",
-                (void *) range.startAddress,
-                range.length
-        );
+static void RecordReturn(FunctionIDOrClientID functionIDOrClientID) {
+    uint64_t now = NowNs();
+    OverheadScope scope(OverheadHooks);
+    MethodStats *method = reinterpret_cast<MethodStats *>(functionIDOrClientID.clientID);
+    ThreadState& state = GetThreadState();
+    CounterSample counters;
+    counters.valid = hardwareCounters && state.ReadCounters(counters);
+    Frame frame;
+    if (state.Pop(method, frame)) {
+        uint64_t elapsed = now - frame.startNs;
+        method->Record(elapsed);
+
+        // Pop left the depth at the popped frame's index.
+        MethodCounters *methodCounters = method->counters.load(std::memory_order_relaxed);
+        CounterSample *enterCounters = counters.valid ? state.FrameCounters(state.Depth()) : nullptr;
+        if (methodCounters != nullptr && enterCounters != nullptr) {
+            methodCounters->Record(*enterCounters, counters);
+        }
 
-        printf("      data:");
-        for (UINT_PTR index = 0; index < range.length; index++) {
-            uint8_t byte = *(((uint8_t *) range.startAddress) + index);
-            printf(" %02x", byte);
+        // A wait called by another wait is filed by the outer one.
+        MethodStats *caller = state.Top();
+        if (
+                method->kind == MethodKind::Wait
+                && elapsed >= (uint64_t) profiler->config.waitThresholdUs * 1000
+                && (caller == nullptr || caller->kind != MethodKind::Wait)
+        ) {
+            RecordWait(method, (ClassID) frame.context, elapsed);
         }
-        printf("\n");
+        FinishTest(state, now, false);
     }
+
+    TraceEvent(state, RecordLeave, method, nullptr, now);
 }
 
 PROFILER_STUB LeaveStub(
-        FunctionID functionId,
+        FunctionIDOrClientID functionIDOrClientID,
         COR_PRF_ELT_INFO eltInfo
 ) {
+    RecordReturn(functionIDOrClientID);
 }
 
 PROFILER_STUB TailcallStub(
-        FunctionID functionId,
+        FunctionIDOrClientID functionIDOrClientID,
         COR_PRF_ELT_INFO eltInfo
 ) {
+    // The frame is replaced by its tail callee, so it ends here.
+    RecordReturn(functionIDOrClientID);
 }
 
+EXTERN_C void CoverNaked(
+        FunctionIDOrClientID functionIDOrClientID
+);
 EXTERN_C void EnterNaked(
         FunctionIDOrClientID functionIDOrClientID,
         COR_PRF_ELT_INFO eltInfo
@@ -222,44 +475,142 @@ EXTERN_C void TailcallNaked(
         COR_PRF_ELT_INFO eltInfo
 );
 
+// Sketches for the arguments of `functionToken`, or nullptr when none of them
+// can be decoded.
+static ArgumentSketches *CreateSketches(ICorProfilerInfo2& info, ModuleID moduleId, mdToken functionToken) {
+    OverheadScope scope(OverheadMetadata);
+    CComPtr<IMetaDataImport2> metaDataImport2;
+    HRESULT result = info.GetModuleMetaData(moduleId, ofRead, IID_IMetaDataImport, (IUnknown **) &metaDataImport2);
+    if (FAILED(result)) {
+        printf("Error: GetModuleMetaData %x\n", result);
+        return nullptr;
+    }
+    PCCOR_SIGNATURE signature = nullptr;
+    ULONG size = 0;
+    result = metaDataImport2->GetMethodProps(
+            functionToken,
+            nullptr,
+            nullptr,
+            0,
+            nullptr,
+            nullptr,
+            &signature,
+            &size,
+            nullptr,
+            nullptr
+    );
+    if (FAILED(result)) {
+        printf("Error: GetMethodProps %x\n", result);
+        return nullptr;
+    }
+    return ArgumentSketches::Create(signature, size, (size_t) profiler->config.argumentTopK);
+}
+
+static void CreateCounters(MethodStats *method) {
+    if (!hardwareCounters || !GetMemoryBudget().TryReserve(sizeof(MethodCounters))) {
+        return;
+    }
+    method->counters.store(new MethodCounters(), std::memory_order_release);
+}
+
 UINT_PTR __stdcall _FunctionIDMapper2(
         [in] FunctionID functionId,
         [in] void *clientData,
         [out] BOOL *pbHookFunction
 ) {
+    OverheadScope scope(OverheadMapper);
     ICorProfilerInfo2& info = *static_cast<ICorProfilerInfo2 *>(clientData);
+    *pbHookFunction = false;
+
+    std::string dynamicName;
+    if (
+            profiler->config.dynamicMethods
+            && !coverageMode
+            && profiler->profile.dynamicMethods.Find(functionId, dynamicName)
+    ) {
+        if (!profiler->modules.ShouldHookDynamic(dynamicName)) {
+            return functionId;
+        }
+        MethodStats *method = profiler->profile.methods.Add(functionId, 0, mdTokenNil, MethodKind::Normal);
+        if (method == nullptr) {
+            profiler->profile.drops.methods.fetch_add(1, std::memory_order_relaxed);
+            return functionId;
+        }
+        // There is no metadata for the symbolizer to find it by.
+        method->SetName(dynamicName);
+        CreateCounters(method);
+        *pbHookFunction = true;
+        return reinterpret_cast<UINT_PTR>(method);
+    }
 
-    std::wstring modulePath;
     mdToken functionToken;
     ModuleID moduleId;
-    AssemblyID assemblyId;
-    GetFunctionInfo(info, functionId, functionToken, moduleId, modulePath, assemblyId);
-    std::wstring assemblyName = GetAssemblyName(info, assemblyId);
-    std::wstring signature = GetTypeAndMethodName(info, functionId);
+    HRESULT result = info.GetFunctionInfo2(functionId, 0, NULL, &moduleId, &functionToken, 0, NULL, NULL);
+    if (FAILED(result)) {
+        printf("Error: GetFunctionInfo2 %x\n", result);
+        return functionId;
+    }
 
-    if (
-            assemblyName == L"foo"
-            && signature == L"foo.Program::foo"
-    ) {
-        printf(
-                "Mapping:\n  Module: %s\n  Assembly: %s\n  Signature: %s\n",
-                ToBytes(modulePath).c_str(),
-                ToBytes(assemblyName).c_str(),
-                ToBytes(signature).c_str()
-        );
+    std::shared_ptr<const ModuleInfo> module = profiler->modules.Get(info, moduleId);
+    MethodKind kind;
+    if (module == nullptr || !profiler->modules.ShouldHook(info, *module, functionToken, kind)) {
+        return functionId;
+    }
+
+    if (coverageMode) {
+        UINT_PTR slot = profiler->coverage.Slot(module, functionToken);
+        if (slot == 0) {
+            profiler->profile.drops.methods.fetch_add(1, std::memory_order_relaxed);
+            return functionId;
+        }
         *pbHookFunction = true;
-    } else {
-        *pbHookFunction = false;
-    };
-    return functionId;
+        return slot;
+    }
+
+    MethodStats *method = profiler->profile.methods.Add(functionId, moduleId, functionToken, kind);
+    if (method == nullptr) {
+        profiler->profile.drops.methods.fetch_add(1, std::memory_order_relaxed);
+        return functionId;
+    }
+    if (profiler->config.argumentTopK > 0) {
+        method->arguments.store(CreateSketches(info, moduleId, functionToken), std::memory_order_release);
+    }
+    CreateCounters(method);
+    *pbHookFunction = true;
+    return reinterpret_cast<UINT_PTR>(method);
 };
 
-CorProfiler::CorProfiler() : refCount(0), corProfilerInfo(nullptr)
+CorProfiler::CorProfiler() : refCount(0), corProfilerInfo(nullptr), symbolizer(nullptr), reporter(nullptr), publisher(nullptr), trace(nullptr), detacher(nullptr), triggers(nullptr)
 {
 }
 
 CorProfiler::~CorProfiler()
 {
+    if (this->triggers != nullptr)
+    {
+        delete this->triggers;
+        this->triggers = nullptr;
+    }
+    if (this->detacher != nullptr)
+    {
+        delete this->detacher;
+        this->detacher = nullptr;
+    }
+    if (this->publisher != nullptr)
+    {
+        delete this->publisher;
+        this->publisher = nullptr;
+    }
+    if (this->reporter != nullptr)
+    {
+        delete this->reporter;
+        this->reporter = nullptr;
+    }
+    if (this->symbolizer != nullptr)
+    {
+        delete this->symbolizer;
+        this->symbolizer = nullptr;
+    }
     if (this->corProfilerInfo != nullptr)
     {
         this->corProfilerInfo->Release();
@@ -276,19 +627,110 @@ HRESULT STDMETHODCALLTYPE CorProfiler::Initialize(IUnknown *pICorProfilerInfoUnk
         return E_FAIL;
     }
 
+    this->config = Config::FromEnvironment();
+    GetMemoryBudget().SetLimit(this->config.memoryLimit);
+    this->stringLayout.lengthOffset = 0;
+    this->stringLayout.bufferOffset = 0;
+    if (this->config.argumentTopK > 0) {
+        HRESULT layoutResult = this->corProfilerInfo->GetStringLayout2(
+                &this->stringLayout.lengthOffset,
+                &this->stringLayout.bufferOffset
+        );
+        if (FAILED(layoutResult)) {
+            printf("Error: GetStringLayout2 %x\n", layoutResult);
+            return E_FAIL;
+        }
+    }
+    this->modules.SetFilter(MethodFilter::Parse(this->config.filter));
+    coverageMode = !this->config.coveragePath.empty();
+    hardwareCounters = this->config.hardwareCounters && !coverageMode;
+    if (this->config.waits && !coverageMode) {
+        this->modules.SetWaitFilter(MethodFilter::Parse(WaitMethods));
+    }
+    bool tests = !this->config.tests.empty() && !coverageMode;
+    if (tests) {
+        this->modules.SetTestFilter(MethodFilter::Parse(this->config.tests), this->config.testAttributes);
+    }
+    if (this->config.objectLifetimes && !coverageMode) {
+        this->modules.SetFinalizerFilter(MethodFilter::Parse(FinalizerMethods));
+    }
+    bool startup = !this->config.startup.empty() && !coverageMode;
+    if (startup) {
+        this->modules.SetStartupFilter(MethodFilter::Parse(this->config.startup));
+    }
+
     DWORD eventMask = (
         COR_PRF_MONITOR_ENTERLEAVE
-        | COR_PRF_ENABLE_FRAME_INFO
-        | COR_PRF_ENABLE_FUNCTION_ARGS
-        | COR_PRF_ENABLE_FUNCTION_RETVAL
+        // Modules are indexed for the filter as they load. Module and
+        // function unloads give the symbolizer a last chance to name methods
+        // before their ids become invalid.
+        | COR_PRF_MONITOR_MODULE_LOADS
+        | COR_PRF_MONITOR_FUNCTION_UNLOADS
     );
+    if (
+            !this->config.reportSocket.empty()
+            || !this->config.aggregatorSocket.empty()
+            || !this->config.profilePath.empty()
+            || tests
+            || this->config.objectLifetimes
+    ) {
+        // GC stats, the allocation table, the finalization queue and handles
+        // come from the GC callbacks.
+        eventMask |= COR_PRF_MONITOR_GC;
+    }
+    if (tests) {
+        // Failing tests leave by exception, and allocations are counted one
+        // by one on the allocating thread.
+        eventMask |= COR_PRF_MONITOR_EXCEPTIONS | COR_PRF_ENABLE_OBJECT_ALLOCATED | COR_PRF_MONITOR_OBJECT_ALLOCATED;
+    }
+    if (!coverageMode) {
+        // These force the runtime's slow ELT path, and coverage needs none
+        // of them.
+        eventMask |= COR_PRF_ENABLE_FRAME_INFO | COR_PRF_ENABLE_FUNCTION_ARGS | COR_PRF_ENABLE_FUNCTION_RETVAL;
+    }
+    if (this->config.waits && !coverageMode) {
+        // Slow waits walk the stack for their call site.
+        eventMask |= COR_PRF_ENABLE_STACK_SNAPSHOT;
+    }
+    if (this->config.interop) {
+        eventMask |= COR_PRF_MONITOR_CODE_TRANSITIONS;
+    }
+    if (this->config.dynamicMethods) {
+        eventMask |= COR_PRF_MONITOR_JIT_COMPILATION;
+    }
+    if (startup) {
+        eventMask |= COR_PRF_MONITOR_CLASS_LOADS | COR_PRF_MONITOR_ASSEMBLY_LOADS;
+    }
+    std::vector<TriggerCondition> triggerConditions;
+    if (!TriggerCondition::Parse(this->config.triggers, triggerConditions)) {
+        // Running without them would go unnoticed until the capture that
+        // never came was needed.
+        return E_FAIL;
+    }
+    for (const TriggerCondition& condition : triggerConditions) {
+        if (condition.kind == TriggerCondition::Kind::Exceptions) {
+            eventMask |= COR_PRF_MONITOR_EXCEPTIONS;
+        }
+    }
     HRESULT result = this->corProfilerInfo->SetEventMask2(eventMask, COR_PRF_HIGH_MONITOR_NONE);
+    if (FAILED(result)) {
+        printf("Error: SetEventMask2 %x\n", result);
+        return E_FAIL;
+    }
 
-    HRESULT monitorResult = this->corProfilerInfo->SetEnterLeaveFunctionHooks3WithInfo(
-            EnterNaked,
-            LeaveNaked,
-            TailcallNaked
-    );
+    // The runtime offers no way to unhook a method once it ran, so coverage
+    // mode keeps only an enter hook, and one without COR_PRF_ELT_INFO so the
+    // runtime can call it through its fast ELT helpers.
+    HRESULT monitorResult;
+    if (coverageMode) {
+        monitorResult = this->corProfilerInfo->SetEnterLeaveFunctionHooks3(CoverNaked, nullptr, nullptr);
+    } else {
+        monitorResult = this->corProfilerInfo->SetEnterLeaveFunctionHooks3WithInfo(
+                EnterNaked,
+                LeaveNaked,
+                TailcallNaked
+        );
+    }
     if (FAILED(monitorResult)) {
         return E_FAIL;
     };
@@ -305,13 +747,239 @@ HRESULT STDMETHODCALLTYPE CorProfiler::Initialize(IUnknown *pICorProfilerInfoUnk
         printf("Profiler already initialized\n");
         return E_FAIL;
     }
+
+    // The sink is the last step that can fail, so that nothing is claimed or
+    // started by a failed Initialize.
+    Detail traceDetail = DetailFromName(this->config.traceDetail);
+    TraceSink *sink = nullptr;
+    if (traceDetail != Detail::Counts && !coverageMode) {
+        sink = TraceSink::Create(
+                this->config.traceFormat,
+                this->config.tracePath,
+                this->config.traceCompressThreads
+        );
+        if (sink == nullptr) {
+            return E_FAIL;
+        }
+    }
     profiler = this;
 
+    this->symbolizer = new Symbolizer(*this->corProfilerInfo, this->modules, this->profile.methods);
+    this->symbolizer->Start();
+
+    if (sink != nullptr) {
+        this->trace = new TraceWriter(GetMemoryBudget(), sink, traceDetail);
+        this->trace->Start();
+
+        if (!triggerConditions.empty()) {
+            this->triggers = new Triggers(
+                    this->profile,
+                    *this->trace,
+                    triggerConditions,
+                    this->config.triggerIntervalSeconds,
+                    this->config.triggerCaptureSeconds,
+                    DetailFromName(this->config.triggerIdleDetail),
+                    [this]() {
+                        this->symbolizer->ResolveEntered();
+                    }
+            );
+            this->triggers->Start();
+        }
+    }
+
+    this->StartReporter();
+
     return S_OK;
 }
 
+void CorProfiler::StartReporter()
+{
+    std::function<std::string()> snapshot = [this]() {
+        if (this->symbolizer != nullptr) {
+            this->symbolizer->ResolveEntered();
+        }
+        return FormatProfile(*this->corProfilerInfo, this->profile);
+    };
+    if (!this->config.aggregatorSocket.empty()) {
+        this->publisher = new Publisher(this->config.aggregatorSocket, this->config.aggregatorIntervalSeconds, snapshot);
+        this->publisher->Start();
+    }
+    if (this->config.reportSocket.empty()) {
+        return;
+    }
+    this->reporter = new Reporter(this->config.reportSocket, snapshot);
+    if (!this->reporter->Start()) {
+        delete this->reporter;
+        this->reporter = nullptr;
+    }
+}
+
+// Prints the `count` tests with the highest `key`, skipping tests where it is
+// zero.
+static void PrintTopTests(
+        const char *title,
+        std::vector<TestStats *> tests,
+        const std::function<uint64_t(const TestStats&)>& key,
+        size_t count
+) {
+    std::vector<std::pair<uint64_t, TestStats *>> ranked;
+    for (TestStats *test : tests) {
+        uint64_t value = key(*test);
+        if (value != 0) {
+            ranked.push_back(std::make_pair(value, test));
+        }
+    }
+    if (ranked.empty()) {
+        return;
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const std::pair<uint64_t, TestStats *>& a, const std::pair<uint64_t, TestStats *>& b) {
+        return a.first > b.first;
+    });
+    printf("%s:\n", title);
+    for (size_t i = 0; i < ranked.size() && i < count; i++) {
+        printf("  %lu %s\n", (unsigned long) ranked[i].first, ranked[i].second->method->Name().c_str());
+    }
+}
+
+// Prints the `count` loads of `kind` that took longest before startup
+// ended, nested loads included.
+static void PrintTopLoads(const char *title, std::vector<LoadStats> loads, LoadKind kind, size_t count) {
+    loads.erase(std::remove_if(loads.begin(), loads.end(), [kind](const LoadStats& load) {
+        return load.kind != kind || load.totalNs == 0;
+    }), loads.end());
+    if (loads.empty()) {
+        return;
+    }
+    std::sort(loads.begin(), loads.end(), [](const LoadStats& a, const LoadStats& b) {
+        return a.totalNs > b.totalNs;
+    });
+    printf("%s:\n", title);
+    for (size_t i = 0; i < loads.size() && i < count; i++) {
+        printf("  %lu %s\n", (unsigned long) loads[i].totalNs, loads[i].name.c_str());
+    }
+}
+
+void CorProfiler::Finish()
+{
+    if (this->detacher != nullptr)
+    {
+        delete this->detacher;
+        this->detacher = nullptr;
+    }
+
+    // Triggers resolve names through the symbolizer.
+    if (this->triggers != nullptr)
+    {
+        delete this->triggers;
+        this->triggers = nullptr;
+    }
+
+    // The publisher and the reporter call into corProfilerInfo, so they have
+    // to go first. Stopping the publisher pushes the final totals.
+    if (this->publisher != nullptr)
+    {
+        delete this->publisher;
+        this->publisher = nullptr;
+    }
+    if (this->reporter != nullptr)
+    {
+        delete this->reporter;
+        this->reporter = nullptr;
+    }
+
+    if (this->symbolizer != nullptr)
+    {
+        this->symbolizer->ResolveEntered();
+    }
+
+    // Threads may outlive the profiler and still hand their chunk to the
+    // writer on exit, so it is stopped here but never deleted.
+    if (this->trace != nullptr)
+    {
+        std::vector<TraceSymbol> symbols;
+        for (MethodStats *method : this->profile.methods.List()) {
+            if (method->calls.load() != 0) {
+                TraceSymbol symbol;
+                symbol.functionId = method->functionId;
+                symbol.moduleId = method->moduleId;
+                symbol.token = method->token;
+                symbol.name = method->Name();
+                symbols.push_back(symbol);
+            }
+        }
+        this->trace->Stop(symbols);
+    }
+
+    if (!this->config.profilePath.empty())
+    {
+        std::string text = FormatProfile(*this->corProfilerInfo, this->profile);
+        FILE *file = fopen(this->config.profilePath.c_str(), "w");
+        if (file == nullptr) {
+            printf("Error: cannot open profile_path %s\n", this->config.profilePath.c_str());
+        } else {
+            fwrite(text.data(), 1, text.size(), file);
+            fclose(file);
+        }
+    }
+
+    std::vector<TestStats *> tests = this->profile.tests.List();
+    PrintTopTests("Slowest tests (ns)", tests, [](const TestStats& test) {
+        return test.totalNs.load();
+    }, 10);
+    PrintTopTests("Most allocating tests (bytes)", tests, [](const TestStats& test) {
+        return test.allocatedBytes.load();
+    }, 10);
+
+    std::vector<LoadStats> loads = this->profile.startup.List();
+    PrintTopLoads("Slowest assembly loads during startup (ns)", loads, LoadKind::Assembly, 10);
+    PrintTopLoads("Slowest generic instantiations during startup (ns)", loads, LoadKind::Generic, 10);
+
+    if (!this->config.coveragePath.empty())
+    {
+        std::string text = this->coverage.Format();
+        FILE *file = fopen(this->config.coveragePath.c_str(), "w");
+        if (file == nullptr) {
+            printf("Error: cannot open coverage_path %s\n", this->config.coveragePath.c_str());
+        } else {
+            fwrite(text.data(), 1, text.size(), file);
+            fclose(file);
+        }
+    }
+
+    if (this->symbolizer != nullptr)
+    {
+        delete this->symbolizer;
+        this->symbolizer = nullptr;
+    }
+
+    OverheadTotals overhead = CollectOverhead();
+    printf("Profiler overhead:\n");
+    for (int i = 0; i < OverheadKindCount; i++) {
+        printf(
+                "  %s: %lu ns in %lu calls\n",
+                OverheadKindNames[i],
+                (unsigned long) overhead.ns[i],
+                (unsigned long) overhead.calls[i]
+        );
+    }
+    printf("  trace: %lu bytes\n", (unsigned long) overhead.traceBytes);
+
+    DropStats& drops = this->profile.drops;
+    if (drops.arguments.load() != 0 || drops.events.load() != 0 || drops.methods.load() != 0) {
+        printf(
+                "Profiler dropped data to stay within %lu bytes:\n  arguments: %lu\n  events: %lu\n  methods: %lu\n",
+                (unsigned long) GetMemoryBudget().Limit(),
+                (unsigned long) drops.arguments.load(),
+                (unsigned long) drops.events.load(),
+                (unsigned long) drops.methods.load()
+        );
+    }
+}
+
 HRESULT STDMETHODCALLTYPE CorProfiler::Shutdown()
 {
+    this->Finish();
+
     if (this->corProfilerInfo != nullptr)
     {
         this->corProfilerInfo->Release();
@@ -341,13 +1009,61 @@ HRESULT STDMETHODCALLTYPE CorProfiler::AppDomainShutdownFinished(AppDomainID app
     return S_OK;
 }
 
+// Times a class or assembly load while startup runs. Loads that started
+// before it ended are still popped, so the thread's stack stays balanced.
+static void StartLoad(uintptr_t id, bool assembly) {
+    if (profiler->config.startup.empty() || !profiler->profile.startup.Running()) {
+        return;
+    }
+    GetThreadState().PushLoad(id, assembly, NowNs());
+}
+
+static void FinishLoad(uintptr_t id, bool assembly, HRESULT status) {
+    uint64_t now = NowNs();
+    if (profiler->config.startup.empty()) {
+        return;
+    }
+    ThreadState& state = GetThreadState();
+    uint64_t totalNs;
+    uint64_t selfNs;
+    if (!state.PopLoad(id, assembly, now, totalNs, selfNs)) {
+        return;
+    }
+    if (!profiler->profile.startup.Running()) {
+        return;
+    }
+
+    OverheadScope scope(OverheadMetadata);
+    ICorProfilerInfo2& info = *profiler->corProfilerInfo;
+    LoadKind kind = LoadKind::Assembly;
+    std::string name;
+    if (assembly) {
+        name = ToBytes(GetAssemblyName(info, (AssemblyID) id));
+    } else {
+        bool generic = false;
+        name = ToBytes(GetInstantiatedClassName(info, (ClassID) id, generic));
+        kind = generic ? LoadKind::Generic : LoadKind::Class;
+    }
+    profiler->profile.startup.Record(
+            kind,
+            name,
+            FAILED(status),
+            state.LoadDepth() == 0,
+            totalNs,
+            selfNs,
+            now - totalNs - profiler->profile.startNs
+    );
+}
+
 HRESULT STDMETHODCALLTYPE CorProfiler::AssemblyLoadStarted(AssemblyID assemblyId)
 {
+    StartLoad(assemblyId, true);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::AssemblyLoadFinished(AssemblyID assemblyId, HRESULT hrStatus)
 {
+    FinishLoad(assemblyId, true, hrStatus);
     return S_OK;
 }
 
@@ -368,11 +1084,22 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ModuleLoadStarted(ModuleID moduleId)
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ModuleLoadFinished(ModuleID moduleId, HRESULT hrStatus)
 {
+    if (SUCCEEDED(hrStatus))
+    {
+        // Index the module now, on the loader thread, so that mapping its
+        // functions later is a bit test rather than metadata lookups.
+        this->modules.Get(*this->corProfilerInfo, moduleId);
+    }
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ModuleUnloadStarted(ModuleID moduleId)
 {
+    if (this->symbolizer != nullptr) {
+        this->symbolizer->ResolveModule(moduleId);
+    }
+    this->modules.Remove(moduleId);
+    this->coverage.Remove(moduleId);
     return S_OK;
 }
 
@@ -383,16 +1110,20 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ModuleUnloadFinished(ModuleID moduleId, H
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ModuleAttachedToAssembly(ModuleID moduleId, AssemblyID AssemblyId)
 {
+    // The assembly, and so the filter's verdict, may only be known from here.
+    this->modules.Get(*this->corProfilerInfo, moduleId);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ClassLoadStarted(ClassID classId)
 {
+    StartLoad(classId, false);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ClassLoadFinished(ClassID classId, HRESULT hrStatus)
 {
+    FinishLoad(classId, false, hrStatus);
     return S_OK;
 }
 
@@ -408,6 +1139,10 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ClassUnloadFinished(ClassID classId, HRES
 
 HRESULT STDMETHODCALLTYPE CorProfiler::FunctionUnloadStarted(FunctionID functionId)
 {
+    MethodStats *method = this->profile.methods.Find(functionId);
+    if (method != nullptr && this->symbolizer != nullptr) {
+        this->symbolizer->Resolve(std::vector<MethodStats *>(1, method));
+    }
     return S_OK;
 }
 
@@ -498,11 +1233,45 @@ HRESULT STDMETHODCALLTYPE CorProfiler::RemotingServerSendingReply(GUID *pCookie,
 
 HRESULT STDMETHODCALLTYPE CorProfiler::UnmanagedToManagedTransition(FunctionID functionId, COR_PRF_TRANSITION_REASON reason)
 {
+    uint64_t now = NowNs();
+    OverheadScope scope(OverheadHooks);
+    ThreadState& state = GetThreadState();
+    if (reason == COR_PRF_TRANSITION_CALL)
+    {
+        // Native code calling back into managed code.
+        this->profile.reverseCalls.Add(functionId, 1);
+        state.PushTransition(functionId, true, now);
+        return S_OK;
+    }
+
+    // A P/Invoke returning from native code.
+    uint64_t startNs;
+    if (state.PopTransition(functionId, false, startNs))
+    {
+        this->profile.pinvokeNs.Add(functionId, now - startNs);
+    }
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ManagedToUnmanagedTransition(FunctionID functionId, COR_PRF_TRANSITION_REASON reason)
 {
+    uint64_t now = NowNs();
+    OverheadScope scope(OverheadHooks);
+    ThreadState& state = GetThreadState();
+    if (reason == COR_PRF_TRANSITION_CALL)
+    {
+        // A P/Invoke calling into native code.
+        this->profile.pinvokeCalls.Add(functionId, 1);
+        state.PushTransition(functionId, false, now);
+        return S_OK;
+    }
+
+    // A reverse P/Invoke returning to native code.
+    uint64_t startNs;
+    if (state.PopTransition(functionId, true, startNs))
+    {
+        this->profile.reverseNs.Add(functionId, now - startNs);
+    }
     return S_OK;
 }
 
@@ -548,11 +1317,27 @@ HRESULT STDMETHODCALLTYPE CorProfiler::MovedReferences(ULONG cMovedObjectIDRange
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ObjectAllocated(ObjectID objectId, ClassID classId)
 {
+    // Only enabled for tests. Every object is sized, in a test or not, for
+    // the bytes of `alloc` lines.
+    OverheadScope scope(OverheadHooks);
+    SIZE_T size = 0;
+    if (SUCCEEDED(this->corProfilerInfo->GetObjectSize2(objectId, &size))) {
+        this->profile.allocatedBytes.Add(classId, size);
+    }
+    ThreadState& state = GetThreadState();
+    if (state.test.stats == nullptr) {
+        return S_OK;
+    }
+    state.test.allocatedBytes += size;
+    state.test.allocatedObjects++;
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ObjectsAllocatedByClass(ULONG cClassCount, ClassID classIds[], ULONG cObjects[])
 {
+    for (ULONG i = 0; i < cClassCount; i++) {
+        this->profile.allocations.Add(classIds[i], cObjects[i]);
+    }
     return S_OK;
 }
 
@@ -568,6 +1353,7 @@ HRESULT STDMETHODCALLTYPE CorProfiler::RootReferences(ULONG cRootRefs, ObjectID
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ExceptionThrown(ObjectID thrownObjectId)
 {
+    this->profile.exceptions.fetch_add(1, std::memory_order_relaxed);
     return S_OK;
 }
 
@@ -608,6 +1394,18 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ExceptionOSHandlerLeave(UINT_PTR __unused
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ExceptionUnwindFunctionEnter(FunctionID functionId)
 {
+    // Enabled for tests and exception triggers. Unwound frames get no Leave
+    // callback, so this is where they come off the shadow stack, and where a
+    // test that throws ends.
+    MethodStats *method = this->profile.methods.Find(functionId);
+    if (method == nullptr) {
+        return S_OK;
+    }
+    ThreadState& state = GetThreadState();
+    Frame frame;
+    if (state.Pop(method, frame)) {
+        FinishTest(state, NowNs(), true);
+    }
     return S_OK;
 }
 
@@ -663,6 +1461,7 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ThreadNameChanged(ThreadID threadId, ULON
 
 HRESULT STDMETHODCALLTYPE CorProfiler::GarbageCollectionStarted(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason)
 {
+    this->profile.gc.Started(cGenerations, generationCollected, reason, NowNs());
     return S_OK;
 }
 
@@ -673,11 +1472,20 @@ HRESULT STDMETHODCALLTYPE CorProfiler::SurvivingReferences(ULONG cSurvivingObjec
 
 HRESULT STDMETHODCALLTYPE CorProfiler::GarbageCollectionFinished()
 {
+    this->profile.gc.Finished(NowNs());
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::FinalizeableObjectQueued(DWORD finalizerFlags, ObjectID objectID)
 {
+    if (!this->config.objectLifetimes) {
+        return S_OK;
+    }
+    OverheadScope scope(OverheadHooks);
+    ClassID classId = 0;
+    if (SUCCEEDED(this->corProfilerInfo->GetClassFromObject(objectID, &classId))) {
+        this->profile.finalization.Queued(classId, NowNs());
+    }
     return S_OK;
 }
 
@@ -688,16 +1496,68 @@ HRESULT STDMETHODCALLTYPE CorProfiler::RootReferences2(ULONG cRootRefs, ObjectID
 
 HRESULT STDMETHODCALLTYPE CorProfiler::HandleCreated(GCHandleID handleId, ObjectID initialObjectId)
 {
+    if (!this->config.objectLifetimes) {
+        return S_OK;
+    }
+    OverheadScope scope(OverheadHooks);
+    // Handles created empty, or whose object cannot be looked up, are
+    // counted without a type.
+    ClassID classId = 0;
+    if (initialObjectId != 0 && FAILED(this->corProfilerInfo->GetClassFromObject(initialObjectId, &classId))) {
+        classId = 0;
+    }
+    this->profile.handles.Created(handleId, classId);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::HandleDestroyed(GCHandleID handleId)
 {
+    if (!this->config.objectLifetimes) {
+        return S_OK;
+    }
+    OverheadScope scope(OverheadHooks);
+    this->profile.handles.Destroyed(handleId);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::InitializeForAttach(IUnknown *pCorProfilerInfoUnk, void *pvClientData, UINT cbClientData)
 {
+    HRESULT queryInterfaceResult = pCorProfilerInfoUnk->QueryInterface(__uuidof(ICorProfilerInfo8), reinterpret_cast<void **>(&this->corProfilerInfo));
+
+    if (FAILED(queryInterfaceResult))
+    {
+        return E_FAIL;
+    }
+
+    if (profiler != nullptr) {
+        printf("Profiler already initialized\n");
+        return E_FAIL;
+    }
+
+    this->config = Config::FromClientData(pvClientData, cbClientData);
+    GetMemoryBudget().SetLimit(this->config.memoryLimit);
+
+    // The ELT hooks and the function mapper can only be set up at startup, so
+    // an attached profiler sticks to what may be enabled later: GC stats and
+    // the allocation table. No method is ever hooked, which is also what
+    // makes detaching possible.
+    DWORD eventMask = COR_PRF_MONITOR_GC & COR_PRF_ALLOWABLE_AFTER_ATTACH;
+    HRESULT result = this->corProfilerInfo->SetEventMask2(eventMask, COR_PRF_HIGH_MONITOR_NONE);
+    if (FAILED(result)) {
+        printf("Error: SetEventMask2 %x\n", result);
+        return E_FAIL;
+    }
+    // Only now that attaching cannot fail, so a failed attach leaves room
+    // for the next one.
+    profiler = this;
+
+    this->StartReporter();
+
+    if (this->config.detachAfter > 0) {
+        this->detacher = new Detacher(*this->corProfilerInfo, this->config.detachAfter);
+        this->detacher->Start();
+    }
+
     return S_OK;
 }
 
@@ -708,6 +1568,16 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ProfilerAttachComplete()
 
 HRESULT STDMETHODCALLTYPE CorProfiler::ProfilerDetachSucceeded()
 {
+    // No thread is in a callback any more and the library is about to be
+    // unloaded, so every thread of ours has to be joined here.
+    this->Finish();
+
+    if (this->corProfilerInfo != nullptr)
+    {
+        this->corProfilerInfo->Release();
+        this->corProfilerInfo = nullptr;
+    }
+
     return S_OK;
 }
 
@@ -758,10 +1628,34 @@ HRESULT STDMETHODCALLTYPE CorProfiler::ModuleInMemorySymbolsUpdated(ModuleID mod
 
 HRESULT STDMETHODCALLTYPE CorProfiler::DynamicMethodJITCompilationStarted(FunctionID functionId, BOOL fIsSafeToBlock, LPCBYTE ilHeader, ULONG cbILHeader)
 {
+    if (!this->config.dynamicMethods) {
+        return S_OK;
+    }
+    uint64_t now = NowNs();
+    OverheadScope scope(OverheadMetadata);
+    // Names other than the one given to DynamicMethod are made up by the
+    // runtime, e.g. `lambda_method` for expression trees.
+    ULONG size = 0;
+    this->corProfilerInfo->GetDynamicFunctionInfo(functionId, nullptr, nullptr, nullptr, 0, &size, nullptr);
+    std::vector<WCHAR> name(size + 1, 0);
+    HRESULT result = this->corProfilerInfo->GetDynamicFunctionInfo(
+            functionId,
+            nullptr,
+            nullptr,
+            nullptr,
+            size,
+            &size,
+            name.data()
+    );
+    std::string text = SUCCEEDED(result) && size > 0 ? ToBytes(ToWideString(name.data(), size)) : std::string("?");
+    this->profile.dynamicMethods.Started(functionId, text, ilHeader, cbILHeader, now);
     return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE CorProfiler::DynamicMethodJITCompilationFinished(FunctionID functionId, HRESULT hrStatus, BOOL fIsSafeToBlock)
 {
+    if (this->config.dynamicMethods) {
+        this->profile.dynamicMethods.Finished(functionId, hrStatus, NowNs());
+    }
     return S_OK;
 }
@@ -3,15 +3,42 @@
 #include <atomic>
 #include "cor.h"
 #include "corprof.h"
+#include "Config.h"
+#include "Coverage.h"
+#include "Detacher.h"
+#include "ModuleTable.h"
+#include "Profile.h"
+#include "Publisher.h"
+#include "Reporter.h"
+#include "Symbolizer.h"
+#include "TraceWriter.h"
+#include "Triggers.h"
 
 class CorProfiler : public ICorProfilerCallback8
 {
 private:
     std::atomic<int> refCount;
+
+    void StartReporter();
+
+    // Produces the final output and stops every profiler thread; shared by
+    // shutdown and detach.
+    void Finish();
 public:
     CorProfiler();
     virtual ~CorProfiler();
     ICorProfilerInfo8* corProfilerInfo;
+    Config config;
+    Profile profile;
+    ModuleTable modules;
+    CoverageMap coverage;
+    StringLayout stringLayout;
+    Symbolizer* symbolizer;
+    Reporter* reporter;
+    Publisher* publisher;
+    TraceWriter* trace;
+    Detacher* detacher;
+    Triggers* triggers;
     HRESULT STDMETHODCALLTYPE Initialize(IUnknown* pICorProfilerInfoUnk) override;
     HRESULT STDMETHODCALLTYPE Shutdown() override;
     HRESULT STDMETHODCALLTYPE AppDomainCreationStarted(AppDomainID appDomainId) override;
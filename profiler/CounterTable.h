@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity, lock-free open-addressing table of 64-bit counters keyed by
+// a non-zero runtime id (ClassID, FunctionID, ...). Slots are never removed,
+// so readers can walk the table while writers keep adding to it. Increments
+// that find no free slot are accumulated in `overflow` instead of being lost.
+class CounterTable
+{
+private:
+    size_t capacity;
+    std::atomic<uintptr_t>* keys;
+    std::atomic<uint64_t>* values;
+    std::atomic<uint64_t> overflow;
+
+    size_t Hash(uintptr_t key) const {
+        uint64_t hash = (uint64_t) key * 0x9E3779B97F4A7C15ull;
+        return (size_t) (hash >> 32) & (this->capacity - 1);
+    }
+
+public:
+    CounterTable(const CounterTable&) = delete;
+    CounterTable& operator= (const CounterTable&) = delete;
+
+    // `capacity` must be a power of two.
+    explicit CounterTable(size_t capacity) :
+        capacity(capacity),
+        keys(new std::atomic<uintptr_t>[capacity]()),
+        values(new std::atomic<uint64_t>[capacity]()),
+        overflow(0)
+    {
+    }
+
+    ~CounterTable()
+    {
+        delete[] this->keys;
+        delete[] this->values;
+    }
+
+    void Add(uintptr_t key, uint64_t delta) {
+        size_t index = this->Hash(key);
+        for (size_t probe = 0; probe < this->capacity; probe++) {
+            uintptr_t current = this->keys[index].load(std::memory_order_acquire);
+            if (current == 0) {
+                uintptr_t expected = 0;
+                if (this->keys[index].compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+                    current = key;
+                } else {
+                    current = expected;
+                }
+            }
+            if (current == key) {
+                this->values[index].fetch_add(delta, std::memory_order_relaxed);
+                return;
+            }
+            index = (index + 1) & (this->capacity - 1);
+        }
+        this->overflow.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    uint64_t Get(uintptr_t key) const {
+        size_t index = this->Hash(key);
+        for (size_t probe = 0; probe < this->capacity; probe++) {
+            uintptr_t current = this->keys[index].load(std::memory_order_acquire);
+            if (current == key) {
+                return this->values[index].load(std::memory_order_relaxed);
+            }
+            if (current == 0) {
+                return 0;
+            }
+            index = (index + 1) & (this->capacity - 1);
+        }
+        return 0;
+    }
+
+    uint64_t Overflow() const {
+        return this->overflow.load(std::memory_order_relaxed);
+    }
+
+    template <typename Visitor>
+    void ForEach(Visitor visit) const {
+        for (size_t index = 0; index < this->capacity; index++) {
+            uintptr_t key = this->keys[index].load(std::memory_order_acquire);
+            if (key != 0) {
+                visit(key, this->values[index].load(std::memory_order_relaxed));
+            }
+        }
+    }
+};
@@ -0,0 +1,77 @@
+#include "Coverage.h"
+#include "MemoryBudget.h"
+#include <iomanip>
+#include <sstream>
+
+CoverageMap::~CoverageMap()
+{
+    for (ModuleCoverage* module : this->modules) {
+        delete module;
+    }
+}
+
+UINT_PTR CoverageMap::Slot(const std::shared_ptr<const ModuleInfo>& module, mdToken token) {
+    if (!module->IsIndexed(token)) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    ModuleCoverage* coverage = nullptr;
+    auto found = this->byModuleId.find(module->moduleId);
+    if (found != this->byModuleId.end()) {
+        coverage = found->second;
+    } else {
+        size_t words = module->hooked.size();
+        if (!GetMemoryBudget().TryReserve(sizeof(ModuleCoverage) + words * sizeof(uint64_t))) {
+            return 0;
+        }
+        coverage = new ModuleCoverage;
+        coverage->module = module;
+        coverage->words = words;
+        coverage->covered.reset(new std::atomic<uint64_t>[words]);
+        for (size_t i = 0; i < words; i++) {
+            coverage->covered[i].store(0, std::memory_order_relaxed);
+        }
+        this->byModuleId[module->moduleId] = coverage;
+        this->modules.push_back(coverage);
+    }
+
+    ULONG rid = RidFromToken(token);
+    return reinterpret_cast<UINT_PTR>(&coverage->covered[rid / 64]) << 6 | (rid % 64);
+}
+
+void CoverageMap::Remove(ModuleID moduleId) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->byModuleId.erase(moduleId);
+}
+
+std::string CoverageMap::Format() {
+    std::ostringstream out;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (ModuleCoverage* coverage : this->modules) {
+        const ModuleInfo& module = *coverage->module;
+        std::vector<uint64_t> covered(coverage->words);
+        int methods = 0;
+        int ran = 0;
+        for (size_t i = 0; i < coverage->words; i++) {
+            covered[i] = coverage->covered[i].load(std::memory_order_relaxed);
+            methods += __builtin_popcountll(module.hooked[i]);
+            ran += __builtin_popcountll(covered[i]);
+        }
+
+        out << "coverage\tassembly=" << module.assemblyName
+            << "\tpath=" << module.path
+            << "\tmethods=" << methods
+            << "\tcovered=" << ran
+            << "\tselected_bits=" << std::hex << std::setfill('0');
+        for (uint64_t word : module.hooked) {
+            out << std::setw(16) << word;
+        }
+        out << "\tcovered_bits=";
+        for (uint64_t word : covered) {
+            out << std::setw(16) << word;
+        }
+        out << std::setfill(' ') << std::dec << "\n";
+    }
+    return out.str();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "ModuleTable.h"
+
+// Which of a module's methods ran at least once, one bit per MethodDef RID.
+// The module's index is kept alive with it, so the bitmap can still be
+// written out after the module unloads.
+struct ModuleCoverage
+{
+    std::shared_ptr<const ModuleInfo> module;
+    size_t words;
+    std::unique_ptr<std::atomic<uint64_t>[]> covered;
+};
+
+// Coverage mode: instead of a MethodStats, the function ID mapper returns a
+// slot naming one bit of a ModuleCoverage, and the enter hook only sets it.
+// A slot is the address of the bitmap word shifted left by 6 with the bit
+// index below; user-space addresses leave room for that.
+class CoverageMap
+{
+private:
+    std::mutex mutex;
+    std::unordered_map<ModuleID, ModuleCoverage*> byModuleId;
+    std::vector<ModuleCoverage*> modules;
+
+public:
+    ~CoverageMap();
+
+    // Returns the slot for method `token` of `module`, or 0 when the module
+    // index does not cover it or the memory budget has no room.
+    UINT_PTR Slot(const std::shared_ptr<const ModuleInfo>& module, mdToken token);
+
+    static void Cover(UINT_PTR slot)
+    {
+        std::atomic<uint64_t>* word = reinterpret_cast<std::atomic<uint64_t>*>(slot >> 6);
+        uint64_t bit = (uint64_t) 1 << (slot & 63);
+        // Only the first entry pays for the read-modify-write.
+        if ((word->load(std::memory_order_relaxed) & bit) == 0) {
+            word->fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+
+    // Forgets the ModuleID of an unloaded module, keeping its bitmap.
+    void Remove(ModuleID moduleId);
+
+    // One `coverage` line per module with the number of methods the filter
+    // selected and ran, and both sets as hex bitmaps: 16 digits per 64 RIDs,
+    // lowest RIDs first, bit i of a word standing for RID 64 * word + i.
+    std::string Format();
+};
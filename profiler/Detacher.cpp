@@ -0,0 +1,53 @@
+#include "Detacher.h"
+#include "profiler_pal.h"
+#include <chrono>
+
+// How long the runtime may wait for threads to leave profiler code before
+// it gives up on the detach.
+static const DWORD DetachTimeoutMs = 5000;
+
+Detacher::Detacher(ICorProfilerInfo3& info, int seconds) :
+    info(info),
+    seconds(seconds),
+    stopping(false)
+{
+}
+
+Detacher::~Detacher()
+{
+    this->Stop();
+}
+
+void Detacher::Start() {
+    this->thread = std::thread(&Detacher::Run, this);
+}
+
+void Detacher::Stop() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->wake.notify_one();
+    }
+    this->thread.join();
+}
+
+void Detacher::Run() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        bool stopped = this->wake.wait_for(lock, std::chrono::seconds(this->seconds), [this]() {
+            return this->stopping;
+        });
+        if (stopped) {
+            return;
+        }
+    }
+
+    printf("Detaching profiler after %d s\n", this->seconds);
+    HRESULT result = this->info.RequestProfilerDetach(DetachTimeoutMs);
+    if (FAILED(result)) {
+        printf("Error: RequestProfilerDetach %x\n", result);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "cor.h"
+#include "corprof.h"
+
+// Asks the runtime to detach an attached profiler once the capture window
+// is over. RequestProfilerDetach has to be called from a thread the profiler
+// owns, hence the thread.
+class Detacher
+{
+private:
+    ICorProfilerInfo3& info;
+    int seconds;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread thread;
+
+    void Run();
+
+public:
+    Detacher(ICorProfilerInfo3& info, int seconds);
+    ~Detacher();
+
+    void Start();
+
+    // Cancels a pending detach request, or waits for a sent one to return.
+    void Stop();
+};
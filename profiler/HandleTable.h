@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "MemoryBudget.h"
+
+// Fixed-capacity open-addressing map from live GC handles to the ClassID of
+// the object each was created for, so that HandleDestroyed, which is only
+// given the handle, can be charged to a type. Removed entries leave
+// tombstones, which inserts reuse and which are swept out by rebuilding the
+// table when fewer than an eighth of the slots are left empty. Handles
+// created while three quarters of the table are live are counted in
+// `overflow` and not tracked. The slots are allocated on first use.
+class HandleTable
+{
+private:
+    // Key values that are never valid handles.
+    enum : uintptr_t { Empty = 0, Tombstone = 1 };
+
+    std::mutex mutex;
+    size_t capacity;
+    std::vector<uintptr_t> keys;
+    std::vector<uintptr_t> values;
+    size_t live;
+    size_t tombstones;
+    uint64_t overflow;
+
+    size_t Hash(uintptr_t key) const {
+        uint64_t hash = (uint64_t) key * 0x9E3779B97F4A7C15ull;
+        return (size_t) (hash >> 32) & (this->capacity - 1);
+    }
+
+    void Place(uintptr_t key, uintptr_t value) {
+        size_t index = this->Hash(key);
+        while (this->keys[index] != Empty) {
+            index = (index + 1) & (this->capacity - 1);
+        }
+        this->keys[index] = key;
+        this->values[index] = value;
+    }
+
+    void Rebuild() {
+        std::vector<uintptr_t> keys(this->capacity, Empty);
+        std::vector<uintptr_t> values(this->capacity, 0);
+        keys.swap(this->keys);
+        values.swap(this->values);
+        for (size_t i = 0; i < this->capacity; i++) {
+            if (keys[i] != Empty && keys[i] != Tombstone) {
+                this->Place(keys[i], values[i]);
+            }
+        }
+        this->tombstones = 0;
+    }
+
+public:
+    // `capacity` must be a power of two.
+    explicit HandleTable(size_t capacity) :
+        capacity(capacity),
+        live(0),
+        tombstones(0),
+        overflow(0)
+    {
+    }
+
+    void Insert(uintptr_t key, uintptr_t value) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->keys.empty()) {
+            this->keys.assign(this->capacity, Empty);
+            this->values.assign(this->capacity, 0);
+            GetMemoryBudget().Charge(2 * this->capacity * sizeof(uintptr_t));
+        }
+        if (this->live >= this->capacity / 4 * 3) {
+            this->overflow++;
+            return;
+        }
+        // Keep empty slots around so that probes end quickly.
+        if (this->live + this->tombstones >= this->capacity / 8 * 7) {
+            this->Rebuild();
+        }
+        size_t index = this->Hash(key);
+        size_t reusable = this->capacity;
+        while (this->keys[index] != Empty) {
+            if (this->keys[index] == key) {
+                this->values[index] = value;
+                return;
+            }
+            if (this->keys[index] == Tombstone && reusable == this->capacity) {
+                reusable = index;
+            }
+            index = (index + 1) & (this->capacity - 1);
+        }
+        if (reusable != this->capacity) {
+            index = reusable;
+            this->tombstones--;
+        }
+        this->keys[index] = key;
+        this->values[index] = value;
+        this->live++;
+    }
+
+    // Returns false for handles that are not tracked.
+    bool Remove(uintptr_t key, uintptr_t& value) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->keys.empty()) {
+            return false;
+        }
+        size_t index = this->Hash(key);
+        while (this->keys[index] != Empty) {
+            if (this->keys[index] == key) {
+                value = this->values[index];
+                this->keys[index] = Tombstone;
+                this->live--;
+                this->tombstones++;
+                return true;
+            }
+            index = (index + 1) & (this->capacity - 1);
+        }
+        return false;
+    }
+
+    uint64_t Overflow() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->overflow;
+    }
+};
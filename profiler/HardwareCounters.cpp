@@ -0,0 +1,125 @@
+#include "HardwareCounters.h"
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* const HardwareCounterNames[HardwareCounterCount] = {
+    "cycles",
+    "instructions",
+    "cache_misses",
+    "branch_misses",
+};
+
+ThreadCounters::ThreadCounters()
+{
+    for (int i = 0; i < HardwareCounterCount; i++) {
+        this->fds[i] = -1;
+    }
+}
+
+ThreadCounters::~ThreadCounters()
+{
+#if defined(__linux__)
+    for (int i = HardwareCounterCount - 1; i >= 0; i--) {
+        if (this->fds[i] >= 0) {
+            close(this->fds[i]);
+        }
+    }
+#endif
+}
+
+bool ThreadCounters::IsOpen() const {
+    return this->fds[0] >= 0;
+}
+
+#if defined(__linux__)
+
+static const uint64_t EventConfigs[HardwareCounterCount] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+bool ThreadCounters::Open(uint64_t tid) {
+    for (int i = 0; i < HardwareCounterCount; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = EventConfigs[i];
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // User space only, which also keeps them available under the
+        // default perf_event_paranoid.
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int groupFd = i == 0 ? -1 : this->fds[0];
+        int fd = (int) syscall(SYS_perf_event_open, &attr, (pid_t) tid, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            for (int j = i - 1; j >= 0; j--) {
+                close(this->fds[j]);
+                this->fds[j] = -1;
+            }
+            return false;
+        }
+        this->fds[i] = fd;
+    }
+    return true;
+}
+
+bool ThreadCounters::Read(CounterSample& sample) {
+    if (!this->IsOpen()) {
+        return false;
+    }
+    // PERF_FORMAT_GROUP: the number of events, the two times, then the
+    // values in the order the events joined the group.
+    uint64_t buffer[3 + HardwareCounterCount];
+    ssize_t size = read(this->fds[0], buffer, sizeof(buffer));
+    if (size != (ssize_t) sizeof(buffer) || buffer[0] != HardwareCounterCount) {
+        return false;
+    }
+    sample.enabledNs = buffer[1];
+    sample.runningNs = buffer[2];
+    for (int i = 0; i < HardwareCounterCount; i++) {
+        sample.values[i] = buffer[3 + i];
+    }
+    return true;
+}
+
+#else
+
+bool ThreadCounters::Open(uint64_t tid) {
+    return false;
+}
+
+bool ThreadCounters::Read(CounterSample& sample) {
+    return false;
+}
+
+#endif
+
+MethodCounters::MethodCounters() : calls(0)
+{
+    for (int i = 0; i < HardwareCounterCount; i++) {
+        this->totals[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool MethodCounters::Record(const CounterSample& enter, const CounterSample& leave) {
+    if (
+            !enter.valid
+            || !leave.valid
+            || leave.enabledNs - enter.enabledNs != leave.runningNs - enter.runningNs
+    ) {
+        return false;
+    }
+    this->calls.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < HardwareCounterCount; i++) {
+        this->totals[i].fetch_add(leave.values[i] - enter.values[i], std::memory_order_relaxed);
+    }
+    return true;
+}
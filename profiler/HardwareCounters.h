@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hardware events counted per thread, in the order they are read.
+enum HardwareCounter
+{
+    CounterCycles,
+    CounterInstructions,
+    // Last-level cache misses.
+    CounterCacheMisses,
+    CounterBranchMisses,
+    HardwareCounterCount,
+};
+
+extern const char* const HardwareCounterNames[HardwareCounterCount];
+
+struct CounterSample
+{
+    uint64_t values[HardwareCounterCount];
+    // How long the group was enabled, and actually counting. The two differ
+    // when the PMU is shared and the kernel multiplexes the events.
+    uint64_t enabledNs;
+    uint64_t runningNs;
+    // Whether the read succeeded.
+    bool valid;
+};
+
+// The counters of one thread: a perf_event_open group over its user-space
+// execution, read with a single syscall. Linux only; elsewhere Open fails.
+class ThreadCounters
+{
+public:
+    ThreadCounters();
+    ~ThreadCounters();
+
+    // Opens the group for the OS thread `tid`. Returns false when the kernel
+    // refuses, e.g. for perf_event_paranoid or in a VM without a PMU.
+    bool Open(uint64_t tid);
+    bool IsOpen() const;
+    bool Read(CounterSample& sample);
+
+private:
+    int fds[HardwareCounterCount];
+};
+
+// Hardware counter totals over the calls of one method, callees included.
+struct MethodCounters
+{
+    MethodCounters();
+
+    // Calls whose counters were read at both ends without being multiplexed
+    // in between.
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> totals[HardwareCounterCount];
+
+    // Adds the counts between `enter` and `leave`. Returns false, adding
+    // nothing, when either read failed or the events did not count
+    // throughout.
+    bool Record(const CounterSample& enter, const CounterSample& leave);
+};
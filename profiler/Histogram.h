@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Log-linear histogram: each power of two is split into 2^SubBucketBits
+// buckets, which keeps the relative error of a percentile under 25%.
+class LatencyHistogram
+{
+public:
+    static const int SubBucketBits = 2;
+    static const int BucketCount = 64 << SubBucketBits;
+
+    static int BucketIndex(uint64_t value) {
+        if (value < (1u << SubBucketBits)) {
+            return (int) value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int sub = (int) (value >> (msb - SubBucketBits)) & ((1 << SubBucketBits) - 1);
+        return ((msb - SubBucketBits + 1) << SubBucketBits) | sub;
+    }
+
+    static uint64_t BucketLowerBound(int index) {
+        if (index < (1 << SubBucketBits)) {
+            return (uint64_t) index;
+        }
+        int msb = (index >> SubBucketBits) + SubBucketBits - 1;
+        uint64_t sub = (uint64_t) (index & ((1 << SubBucketBits) - 1));
+        return (1ull << msb) | (sub << (msb - SubBucketBits));
+    }
+
+    static uint64_t BucketUpperBound(int index) {
+        if (index < (1 << SubBucketBits)) {
+            return (uint64_t) index;
+        }
+        int msb = (index >> SubBucketBits) + SubBucketBits - 1;
+        return BucketLowerBound(index) + (1ull << (msb - SubBucketBits)) - 1;
+    }
+
+    LatencyHistogram() {
+        for (int i = 0; i < BucketCount; i++) {
+            this->buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Record(uint64_t value) {
+        this->buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Readers copy the counters without stopping writers, so a snapshot may
+    // be off by the few events recorded while it was being taken.
+    void Snapshot(uint64_t counts[BucketCount]) const {
+        for (int i = 0; i < BucketCount; i++) {
+            counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static uint64_t Percentile(const uint64_t counts[BucketCount], double quantile) {
+        uint64_t total = 0;
+        for (int i = 0; i < BucketCount; i++) {
+            total += counts[i];
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        uint64_t rank = (uint64_t) (quantile * (double) (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BucketCount; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return BucketUpperBound(i);
+            }
+        }
+        return BucketUpperBound(BucketCount - 1);
+    }
+
+private:
+    std::atomic<uint64_t> buckets[BucketCount];
+};
+
+inline void AtomicMax(std::atomic<uint64_t>& target, uint64_t value) {
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
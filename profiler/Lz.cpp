@@ -0,0 +1,175 @@
+#include "Lz.h"
+#include <cstring>
+#include <vector>
+
+static const size_t MinMatch = 4;
+static const size_t LastLiterals = 5;
+// No match may start within this many bytes of the end of the input.
+static const size_t MatchFindLimit = 12;
+static const size_t MaxOffset = 65535;
+static const int HashBits = 12;
+
+static uint32_t Read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t Hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HashBits);
+}
+
+static uint8_t* WriteLength(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t) length;
+    return out;
+}
+
+static uint8_t* WriteSequence(
+        uint8_t* out,
+        const uint8_t* literals,
+        size_t literalLength,
+        size_t offset,
+        size_t matchLength
+) {
+    uint8_t* token = out++;
+    *token = (uint8_t) ((literalLength < 15 ? literalLength : 15) << 4);
+    if (literalLength >= 15) {
+        out = WriteLength(out, literalLength - 15);
+    }
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+
+    if (matchLength == 0) {
+        return out;
+    }
+
+    *out++ = (uint8_t) (offset & 0xff);
+    *out++ = (uint8_t) (offset >> 8);
+    size_t extra = matchLength - MinMatch;
+    *token |= (uint8_t) (extra < 15 ? extra : 15);
+    if (extra >= 15) {
+        out = WriteLength(out, extra - 15);
+    }
+    return out;
+}
+
+size_t LzCompressBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t LzCompress(const uint8_t* source, size_t size, uint8_t* destination) {
+    uint8_t* out = destination;
+    size_t anchor = 0;
+
+    if (size > MatchFindLimit) {
+        std::vector<uint32_t> table(1 << HashBits, 0);
+        size_t position = 0;
+        size_t limit = size - MatchFindLimit;
+
+        while (position < limit) {
+            uint32_t sequence = Read32(source + position);
+            uint32_t hash = Hash(sequence);
+            size_t candidate = table[hash];
+            table[hash] = (uint32_t) position;
+
+            if (
+                    candidate >= position
+                    || position - candidate > MaxOffset
+                    || Read32(source + candidate) != sequence
+            ) {
+                position++;
+                continue;
+            }
+
+            size_t matchLength = MinMatch;
+            while (
+                    position + matchLength < size - LastLiterals
+                    && source[candidate + matchLength] == source[position + matchLength]
+            ) {
+                matchLength++;
+            }
+
+            out = WriteSequence(
+                    out,
+                    source + anchor,
+                    position - anchor,
+                    position - candidate,
+                    matchLength
+            );
+            position += matchLength;
+            anchor = position;
+        }
+    }
+
+    out = WriteSequence(out, source + anchor, size - anchor, 0, 0);
+    return (size_t) (out - destination);
+}
+
+static bool ReadLength(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in >= end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool LzDecompress(const uint8_t* source, size_t size, uint8_t* destination, size_t destinationSize) {
+    const uint8_t* in = source;
+    const uint8_t* end = source + size;
+    uint8_t* out = destination;
+    uint8_t* outEnd = destination + destinationSize;
+
+    while (in < end) {
+        uint8_t token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(in, end, literalLength)) {
+            return false;
+        }
+        if ((size_t) (end - in) < literalLength || (size_t) (outEnd - out) < literalLength) {
+            return false;
+        }
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+
+        if (in == end) {
+            break;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        size_t offset = (size_t) in[0] | ((size_t) in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t) (out - destination)) {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(in, end, matchLength)) {
+            return false;
+        }
+        matchLength += MinMatch;
+        if ((size_t) (outEnd - out) < matchLength) {
+            return false;
+        }
+
+        // Byte by byte: the match may overlap the bytes it produces.
+        const uint8_t* match = out - offset;
+        for (size_t i = 0; i < matchLength; i++) {
+            out[i] = match[i];
+        }
+        out += matchLength;
+    }
+
+    return out == outEnd;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Byte-oriented LZ77 compressor using the LZ4 block format: greedy matching
+// through a hash of 4-byte sequences, 64 KiB window. Fast enough to run on
+// every trace chunk, and the output needs no external library to decode.
+
+// Worst-case compressed size for `size` input bytes.
+size_t LzCompressBound(size_t size);
+
+// Compresses `size` bytes into `destination`, which must hold at least
+// LzCompressBound(size) bytes. Returns the compressed size.
+size_t LzCompress(const uint8_t* source, size_t size, uint8_t* destination);
+
+// Decompresses into exactly `destinationSize` bytes. Returns false when the
+// input is corrupt or does not decode to that size.
+bool LzDecompress(const uint8_t* source, size_t size, uint8_t* destination, size_t destinationSize);
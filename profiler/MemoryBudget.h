@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Process-wide accounting of the memory held by profiler arenas and buffers.
+// Growable buffers reserve against the limit and back off when it is hit;
+// fixed-size structures are charged unconditionally so the figure stays
+// complete. A limit of zero means unbounded.
+class MemoryBudget
+{
+private:
+    std::atomic<size_t> used;
+    size_t limit;
+
+public:
+    MemoryBudget() : used(0), limit(0)
+    {
+    }
+
+    void SetLimit(size_t limit) {
+        this->limit = limit;
+    }
+
+    size_t Limit() const {
+        return this->limit;
+    }
+
+    size_t Used() const {
+        return this->used.load(std::memory_order_relaxed);
+    }
+
+    bool TryReserve(size_t bytes) {
+        size_t current = this->used.load(std::memory_order_relaxed);
+        do {
+            if (this->limit != 0 && current + bytes > this->limit) {
+                return false;
+            }
+        } while (!this->used.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+        return true;
+    }
+
+    void Charge(size_t bytes) {
+        this->used.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void Release(size_t bytes) {
+        this->used.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    // Fraction of the limit in use; always 0 when unbounded.
+    double Utilization() const {
+        if (this->limit == 0) {
+            return 0.0;
+        }
+        return (double) this->Used() / (double) this->limit;
+    }
+};
+
+inline MemoryBudget& GetMemoryBudget() {
+    static MemoryBudget budget;
+    return budget;
+}
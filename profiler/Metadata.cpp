@@ -0,0 +1,249 @@
+#include "Metadata.h"
+#include "corhlpr.h"
+#include "profiler_pal.h"
+#include <codecvt>
+#include <locale>
+#include <vector>
+
+std::string ToBytes(std::wstring wide) {
+    using convert_type = std::codecvt_utf8<wchar_t>;
+    std::wstring_convert<convert_type, wchar_t> converter;
+    return converter.to_bytes(wide);
+}
+
+std::wstring ToWideString(WCHAR array[], size_t size) {
+    std::wstring stringWide;
+    stringWide.reserve(size);
+    for (size_t i = 0; i < size && array[i] != 0; i++) {
+        stringWide.push_back((wchar_t) array[i]);
+    }
+    return stringWide;
+}
+
+std::wstring GetModulePath(ICorProfilerInfo2& info, ModuleID moduleId, AssemblyID& assemblyId) {
+    ULONG size = 0;
+    info.GetModuleInfo(moduleId, NULL, 0, &size, nullptr, &assemblyId);
+
+    std::vector<WCHAR> path(size);
+    HRESULT result = info.GetModuleInfo(moduleId, NULL, size, &size, path.data(), &assemblyId);
+    if (FAILED(result)) {
+        printf("Error: GetModuleInfo\n");
+        return std::wstring();
+    }
+
+    return ToWideString(path.data(), size);
+}
+
+bool GetFunctionInfo(
+        [in] ICorProfilerInfo2& info,
+        [in] FunctionID funcId,
+        [out] mdToken& functionToken,
+        [out] ModuleID& moduleId,
+        [out] std::wstring& modulePath,
+        [out] AssemblyID& assemblyId
+) {
+    HRESULT result = info.GetFunctionInfo2(funcId, 0, NULL, &moduleId, &functionToken, 0, NULL, NULL);
+    if (FAILED(result)) {
+        printf("Error: GetFunctionInfo2 %x\n", result);
+        return false;
+    }
+    modulePath = GetModulePath(info, moduleId, assemblyId);
+    return true;
+}
+
+std::wstring GetAssemblyName(ICorProfilerInfo2& info, AssemblyID assemblyId) {
+    ULONG size = 0;
+    info.GetAssemblyInfo(assemblyId, 0, &size, nullptr, NULL, NULL);
+
+    std::vector<WCHAR> name(size);
+    HRESULT result = info.GetAssemblyInfo(assemblyId, size, &size, name.data(), NULL, NULL);
+    if (FAILED(result)) {
+        printf("Error: GetAssemblyInfo %x\n", result);
+        return std::wstring();
+    }
+
+    return ToWideString(name.data(), size);
+}
+
+std::wstring GetFunctionName(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdToken functionToken,
+        mdTypeDef& classId
+) {
+    ULONG size = 0;
+    metaDataImport2->GetMethodProps(
+            functionToken,
+            &classId,
+            nullptr,
+            512,
+            &size,
+            nullptr,
+            nullptr,
+            nullptr,
+            nullptr,
+            nullptr
+    );
+
+    std::vector<WCHAR> name(size);
+    HRESULT result = metaDataImport2->GetMethodProps(
+            functionToken,
+            &classId,
+            name.data(),
+            size,
+            &size,
+            nullptr,
+            nullptr,
+            nullptr,
+            nullptr,
+            nullptr
+    );
+    if (FAILED(result)) {
+        printf("Error: GetMethodProps %x\n", result);
+        return std::wstring();
+    }
+
+    return ToWideString(name.data(), size);
+}
+
+std::wstring GetFunctionType(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdTypeDef classId
+) {
+    ULONG size = 0;
+    metaDataImport2->GetTypeDefProps(classId, nullptr, 0, &size, nullptr, nullptr);
+
+    std::vector<WCHAR> type(size);
+    HRESULT result = metaDataImport2->GetTypeDefProps(classId, type.data(), size, &size, nullptr, nullptr);
+    if (FAILED(result)) {
+        printf("Error: GetTypeDefProps %x\n", result);
+        return std::wstring();
+    }
+
+    return ToWideString(type.data(), size);
+}
+
+std::wstring GetFullTypeName(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdTypeDef classId
+) {
+    std::wstring type = GetFunctionType(metaDataImport2, classId);
+    mdTypeDef enclosingClassId = mdTypeDefNil;
+    HRESULT result = metaDataImport2->GetNestedClassProps(classId, &enclosingClassId);
+    if (FAILED(result) || enclosingClassId == mdTypeDefNil) {
+        return type;
+    }
+    return GetFullTypeName(metaDataImport2, enclosingClassId) + L"+" + type;
+}
+
+uint32_t HashSignature(PCCOR_SIGNATURE signature, ULONG size) {
+    uint32_t hash = 2166136261u;
+    for (ULONG i = 0; i < size; i++) {
+        hash = (hash ^ signature[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t GetSignatureHash(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdToken functionToken
+) {
+    PCCOR_SIGNATURE signature = nullptr;
+    ULONG size = 0;
+    HRESULT result = metaDataImport2->GetMethodProps(
+            functionToken,
+            nullptr,
+            nullptr,
+            0,
+            nullptr,
+            nullptr,
+            &signature,
+            &size,
+            nullptr,
+            nullptr
+    );
+    if (FAILED(result)) {
+        printf("Error: GetMethodProps %x\n", result);
+        return 0;
+    }
+    return HashSignature(signature, size);
+}
+
+bool HasCustomAttribute(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdToken token,
+        const WCHAR* typeName
+) {
+    // S_FALSE when there is no such attribute.
+    return metaDataImport2->GetCustomAttributeByName(token, typeName, nullptr, nullptr) == S_OK;
+}
+
+std::wstring GetTypeAndMethodName(ICorProfilerInfo2& info, FunctionID functionId) {
+    CComPtr<IMetaDataImport2> metaDataImport2;
+    mdMethodDef functionToken;
+    info.GetTokenAndMetaDataFromFunction(
+            functionId,
+            IID_IMetaDataImport,
+            (IUnknown **) &metaDataImport2,
+            &functionToken
+    );
+
+    mdTypeDef classId;
+    std::wstring name = GetFunctionName(metaDataImport2, functionToken, classId);
+    std::wstring type = GetFullTypeName(metaDataImport2, classId);
+
+    return type + L"::" + name;
+}
+
+std::wstring GetClassName(ICorProfilerInfo2& info, ClassID classId) {
+    ModuleID moduleId;
+    mdTypeDef typeDef;
+    HRESULT result = info.GetClassIDInfo2(classId, &moduleId, &typeDef, nullptr, 0, nullptr, nullptr);
+    if (FAILED(result) || typeDef == mdTypeDefNil) {
+        // Arrays and other runtime-constructed types have no TypeDef.
+        return std::wstring(L"?");
+    }
+
+    CComPtr<IMetaDataImport2> metaDataImport2;
+    result = info.GetModuleMetaData(moduleId, ofRead, IID_IMetaDataImport, (IUnknown **) &metaDataImport2);
+    if (FAILED(result)) {
+        printf("Error: GetModuleMetaData %x\n", result);
+        return std::wstring(L"?");
+    }
+
+    return GetFullTypeName(metaDataImport2, typeDef);
+}
+
+// Type arguments nested deeper than this are left out as `...`.
+static const int MaxTypeArgumentDepth = 4;
+
+static std::wstring InstantiatedClassName(ICorProfilerInfo2& info, ClassID classId, int depth, bool& generic) {
+    std::wstring name = GetClassName(info, classId);
+    ULONG32 count = 0;
+    HRESULT result = info.GetClassIDInfo2(classId, nullptr, nullptr, nullptr, 0, &count, nullptr);
+    if (FAILED(result) || count == 0) {
+        return name;
+    }
+    generic = true;
+    if (depth >= MaxTypeArgumentDepth) {
+        return name + L"<...>";
+    }
+    std::vector<ClassID> arguments(count);
+    result = info.GetClassIDInfo2(classId, nullptr, nullptr, nullptr, count, &count, arguments.data());
+    if (FAILED(result)) {
+        return name;
+    }
+    name += L"<";
+    for (ULONG32 i = 0; i < count && i < arguments.size(); i++) {
+        if (i > 0) {
+            name += L",";
+        }
+        bool nested = false;
+        name += InstantiatedClassName(info, arguments[i], depth + 1, nested);
+    }
+    return name + L">";
+}
+
+std::wstring GetInstantiatedClassName(ICorProfilerInfo2& info, ClassID classId, bool& generic) {
+    generic = false;
+    return InstantiatedClassName(info, classId, 0, generic);
+}
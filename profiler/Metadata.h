@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "cor.h"
+#include "corprof.h"
+#include "CComPtr.h"
+
+std::string ToBytes(std::wstring wide);
+
+std::wstring ToWideString(WCHAR array[], size_t size);
+
+std::wstring GetModulePath(ICorProfilerInfo2& info, ModuleID moduleId, AssemblyID& assemblyId);
+
+bool GetFunctionInfo(
+        [in] ICorProfilerInfo2& info,
+        [in] FunctionID funcId,
+        [out] mdToken& functionToken,
+        [out] ModuleID& moduleId,
+        [out] std::wstring& modulePath,
+        [out] AssemblyID& assemblyId
+);
+
+std::wstring GetAssemblyName(ICorProfilerInfo2& info, AssemblyID assemblyId);
+
+std::wstring GetFunctionName(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdToken functionToken,
+        mdTypeDef& classId
+);
+
+std::wstring GetFunctionType(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdTypeDef classId
+);
+
+// Like GetFunctionType, but prefixes nested types with their enclosing types,
+// e.g. `Namespace.Outer+Inner`, the way reflection names them.
+std::wstring GetFullTypeName(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdTypeDef classId
+);
+
+// FNV-1a over a method's signature blob, which tells overloads apart across
+// runs where tokens and ids may change.
+uint32_t HashSignature(PCCOR_SIGNATURE signature, ULONG size);
+
+uint32_t GetSignatureHash(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdToken functionToken
+);
+
+// Whether `token` carries a custom attribute of the type named `typeName`,
+// e.g. `Xunit.FactAttribute`. Only the attribute's own type counts, not types
+// derived from it.
+bool HasCustomAttribute(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        mdToken token,
+        const WCHAR* typeName
+);
+
+std::wstring GetTypeAndMethodName(ICorProfilerInfo2& info, FunctionID functionId);
+
+std::wstring GetClassName(ICorProfilerInfo2& info, ClassID classId);
+
+// Like GetClassName, but spells out type arguments, e.g.
+// `System.Collections.Generic.List`1<System.String>`. `generic` tells whether
+// there were any.
+std::wstring GetInstantiatedClassName(ICorProfilerInfo2& info, ClassID classId, bool& generic);
@@ -0,0 +1,81 @@
+#include "MethodFilter.h"
+
+MethodFilter MethodFilter::Parse(const std::string& spec) {
+    MethodFilter filter;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(';', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(start, end - start);
+        start = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+
+        Pattern pattern;
+        size_t bang = item.find('!');
+        pattern.assembly = bang == std::string::npos ? "*" : item.substr(0, bang);
+        std::string member = bang == std::string::npos ? item : item.substr(bang + 1);
+        size_t colons = member.find("::");
+        if (colons == std::string::npos) {
+            pattern.type = member.empty() ? "*" : member;
+            pattern.method = "*";
+        } else {
+            pattern.type = member.substr(0, colons);
+            pattern.method = member.substr(colons + 2);
+        }
+        filter.patterns.push_back(pattern);
+    }
+    return filter;
+}
+
+bool MethodFilter::MatchesAssembly(const std::string& assembly) const {
+    for (const Pattern& pattern : this->patterns) {
+        if (Glob(pattern.assembly, assembly)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MethodFilter::Matches(const std::string& assembly, const std::string& type, const std::string& method) const {
+    for (const Pattern& pattern : this->patterns) {
+        if (
+                Glob(pattern.assembly, assembly)
+                && Glob(pattern.type, type)
+                && Glob(pattern.method, method)
+        ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MethodFilter::Glob(const std::string& pattern, const std::string& text) {
+    // Iterative matcher: on mismatch, backtrack to the last `*` and let it
+    // swallow one more character.
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = std::string::npos;
+    size_t resume = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = t;
+        } else if (p < pattern.size() && pattern[p] == text[t]) {
+            p++;
+            t++;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
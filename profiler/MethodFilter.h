@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Selects the methods to hook from a `;`-separated list of
+// `Assembly!Namespace.Type::Method` patterns, where `*` matches any run of
+// characters, e.g. `MyApp!MyApp.Services.*::Get*;MyApp.Data!*`. A pattern
+// without `::` matches every method of the types it names.
+class MethodFilter
+{
+private:
+    struct Pattern
+    {
+        std::string assembly;
+        std::string type;
+        std::string method;
+    };
+
+    std::vector<Pattern> patterns;
+
+public:
+    static MethodFilter Parse(const std::string& spec);
+
+    // Whether any pattern can match a method of `assembly`, so modules of
+    // other assemblies need not be looked at any further.
+    bool MatchesAssembly(const std::string& assembly) const;
+
+    bool Matches(const std::string& assembly, const std::string& type, const std::string& method) const;
+
+    static bool Glob(const std::string& pattern, const std::string& text);
+};
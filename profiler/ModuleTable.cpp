@@ -0,0 +1,381 @@
+#include "ModuleTable.h"
+#include "CComPtr.h"
+#include "MemoryBudget.h"
+#include "Metadata.h"
+#include "Overhead.h"
+#include "profiler_pal.h"
+#include <algorithm>
+
+// Tokens fetched per metadata enumeration call.
+static const ULONG EnumBatchSize = 256;
+
+static bool TestBit(const std::vector<uint64_t>& bits, ULONG rid) {
+    return rid / 64 < bits.size() && (bits[rid / 64] >> (rid % 64) & 1) != 0;
+}
+
+bool ModuleInfo::IsIndexed(mdToken token) const {
+    ULONG rid = RidFromToken(token);
+    return rid + 1 < this->nameOffsets.size();
+}
+
+bool ModuleInfo::IsHooked(mdToken token) const {
+    return TestBit(this->hooked, RidFromToken(token));
+}
+
+bool ModuleInfo::IsWait(mdToken token) const {
+    return TestBit(this->waits, RidFromToken(token));
+}
+
+bool ModuleInfo::IsTest(mdToken token) const {
+    return TestBit(this->tests, RidFromToken(token));
+}
+
+bool ModuleInfo::IsFinalizer(mdToken token) const {
+    return TestBit(this->finalizers, RidFromToken(token));
+}
+
+bool ModuleInfo::IsStartup(mdToken token) const {
+    return TestBit(this->startups, RidFromToken(token));
+}
+
+std::string ModuleInfo::MethodName(mdToken token) const {
+    ULONG rid = RidFromToken(token);
+    if (rid + 1 >= this->nameOffsets.size()) {
+        return std::string();
+    }
+    uint32_t begin = this->nameOffsets[rid];
+    return this->names.substr(begin, this->nameOffsets[rid + 1] - begin);
+}
+
+uint32_t ModuleInfo::Signature(mdToken token) const {
+    ULONG rid = RidFromToken(token);
+    return rid < this->signatures.size() ? this->signatures[rid] : 0;
+}
+
+size_t ModuleInfo::Footprint() const {
+    return (
+            sizeof(ModuleInfo)
+            + this->path.size()
+            + this->assemblyName.size()
+            + (
+                    this->hooked.size() + this->waits.size() + this->tests.size()
+                    + this->finalizers.size() + this->startups.size()
+            ) * sizeof(uint64_t)
+            + (this->nameOffsets.size() + this->signatures.size()) * sizeof(uint32_t)
+            + this->names.size()
+    );
+}
+
+void ModuleTable::SetFilter(const MethodFilter& filter) {
+    this->filter = filter;
+}
+
+void ModuleTable::SetWaitFilter(const MethodFilter& filter) {
+    this->waitFilter = filter;
+}
+
+void ModuleTable::SetTestFilter(const MethodFilter& filter, const std::string& attributes) {
+    this->testFilter = filter;
+    this->testAttributes.clear();
+    size_t start = 0;
+    while (start < attributes.size()) {
+        size_t end = attributes.find(';', start);
+        if (end == std::string::npos) {
+            end = attributes.size();
+        }
+        if (end > start) {
+            // Type names are ASCII, so widening each byte is enough.
+            std::vector<WCHAR> name(attributes.begin() + start, attributes.begin() + end);
+            name.push_back(0);
+            this->testAttributes.push_back(name);
+        }
+        start = end + 1;
+    }
+}
+
+void ModuleTable::SetFinalizerFilter(const MethodFilter& filter) {
+    this->finalizerFilter = filter;
+}
+
+void ModuleTable::SetStartupFilter(const MethodFilter& filter) {
+    this->startupFilter = filter;
+}
+
+bool ModuleTable::IsTest(
+        CComPtr<IMetaDataImport2>& metaDataImport2,
+        const std::string& assembly,
+        const std::string& type,
+        const std::string& method,
+        mdToken token
+) const {
+    if (!this->testFilter.Matches(assembly, type, method)) {
+        return false;
+    }
+    if (this->testAttributes.empty()) {
+        return true;
+    }
+    for (const std::vector<WCHAR>& attribute : this->testAttributes) {
+        if (HasCustomAttribute(metaDataImport2, token, attribute.data())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ModuleTable::Index(ICorProfilerInfo2& info, ModuleInfo& module) {
+    OverheadScope scope(OverheadMetadata);
+    CComPtr<IMetaDataImport2> metaDataImport2;
+    HRESULT result = info.GetModuleMetaData(
+            module.moduleId,
+            ofRead,
+            IID_IMetaDataImport,
+            (IUnknown **) &metaDataImport2
+    );
+    if (FAILED(result)) {
+        printf("Error: GetModuleMetaData %x\n", result);
+        return;
+    }
+
+    // Global functions are enumerated through mdTypeDefNil.
+    std::vector<mdTypeDef> types(1, mdTypeDefNil);
+    HCORENUM typeEnum = nullptr;
+    mdTypeDef typeBatch[EnumBatchSize];
+    ULONG count = 0;
+    while (SUCCEEDED(metaDataImport2->EnumTypeDefs(&typeEnum, typeBatch, EnumBatchSize, &count)) && count > 0) {
+        types.insert(types.end(), typeBatch, typeBatch + count);
+    }
+    metaDataImport2->CloseEnum(typeEnum);
+
+    struct Entry
+    {
+        ULONG rid;
+        bool hooked;
+        bool wait;
+        bool test;
+        bool finalizer;
+        bool startup;
+        uint32_t signature;
+        std::string name;
+    };
+    std::vector<Entry> entries;
+    std::vector<WCHAR> methodName(512);
+    for (mdTypeDef type : types) {
+        std::string typeName = type == mdTypeDefNil
+                ? std::string("<Module>")
+                : ToBytes(GetFullTypeName(metaDataImport2, type));
+
+        HCORENUM methodEnum = nullptr;
+        mdMethodDef methodBatch[EnumBatchSize];
+        while (SUCCEEDED(metaDataImport2->EnumMethods(&methodEnum, type, methodBatch, EnumBatchSize, &count)) && count > 0) {
+            for (ULONG i = 0; i < count; i++) {
+                mdTypeDef classId;
+                ULONG size = 0;
+                PCCOR_SIGNATURE signature = nullptr;
+                ULONG signatureSize = 0;
+                result = metaDataImport2->GetMethodProps(
+                        methodBatch[i],
+                        &classId,
+                        methodName.data(),
+                        (ULONG) methodName.size(),
+                        &size,
+                        nullptr,
+                        &signature,
+                        &signatureSize,
+                        nullptr,
+                        nullptr
+                );
+                if (SUCCEEDED(result) && size > methodName.size()) {
+                    // Truncated; the first call told us how much room it needs.
+                    methodName.resize(size);
+                    result = metaDataImport2->GetMethodProps(
+                            methodBatch[i],
+                            &classId,
+                            methodName.data(),
+                            size,
+                            &size,
+                            nullptr,
+                            nullptr,
+                            nullptr,
+                            nullptr,
+                            nullptr
+                    );
+                }
+                if (FAILED(result)) {
+                    continue;
+                }
+
+                Entry entry;
+                entry.rid = RidFromToken(methodBatch[i]);
+                std::string name = ToBytes(ToWideString(methodName.data(), size));
+                entry.hooked = this->filter.Matches(module.assemblyName, typeName, name);
+                entry.wait = this->waitFilter.Matches(module.assemblyName, typeName, name);
+                entry.test = this->IsTest(metaDataImport2, module.assemblyName, typeName, name, methodBatch[i]);
+                entry.finalizer = this->finalizerFilter.Matches(module.assemblyName, typeName, name);
+                entry.startup = this->startupFilter.Matches(module.assemblyName, typeName, name);
+                entry.signature = HashSignature(signature, signatureSize);
+                entry.name = typeName + "::" + name;
+                entries.push_back(std::move(entry));
+            }
+        }
+        metaDataImport2->CloseEnum(methodEnum);
+    }
+    if (entries.empty()) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.rid < b.rid;
+    });
+    ULONG maxRid = entries.back().rid;
+    module.hooked.assign(maxRid / 64 + 1, 0);
+    module.waits.assign(maxRid / 64 + 1, 0);
+    module.tests.assign(maxRid / 64 + 1, 0);
+    module.finalizers.assign(maxRid / 64 + 1, 0);
+    module.startups.assign(maxRid / 64 + 1, 0);
+    module.nameOffsets.reserve(maxRid + 2);
+    module.signatures.assign(maxRid + 1, 0);
+    size_t next = 0;
+    for (ULONG rid = 0; rid <= maxRid; rid++) {
+        module.nameOffsets.push_back((uint32_t) module.names.size());
+        if (next < entries.size() && entries[next].rid == rid) {
+            module.names += entries[next].name;
+            module.signatures[rid] = entries[next].signature;
+            if (
+                    entries[next].hooked
+                    || entries[next].wait
+                    || entries[next].test
+                    || entries[next].finalizer
+                    || entries[next].startup
+            ) {
+                module.hooked[rid / 64] |= (uint64_t) 1 << (rid % 64);
+            }
+            if (entries[next].wait) {
+                module.waits[rid / 64] |= (uint64_t) 1 << (rid % 64);
+            }
+            if (entries[next].test) {
+                module.tests[rid / 64] |= (uint64_t) 1 << (rid % 64);
+            }
+            if (entries[next].finalizer) {
+                module.finalizers[rid / 64] |= (uint64_t) 1 << (rid % 64);
+            }
+            if (entries[next].startup) {
+                module.startups[rid / 64] |= (uint64_t) 1 << (rid % 64);
+            }
+            next++;
+        }
+    }
+    module.nameOffsets.push_back((uint32_t) module.names.size());
+}
+
+std::shared_ptr<const ModuleInfo> ModuleTable::Get(ICorProfilerInfo2& info, ModuleID moduleId) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto found = this->modules.find(moduleId);
+        if (found != this->modules.end()) {
+            return found->second;
+        }
+    }
+
+    std::shared_ptr<ModuleInfo> module = std::make_shared<ModuleInfo>();
+    module->moduleId = moduleId;
+    module->assemblyId = 0;
+    module->path = ToBytes(GetModulePath(info, moduleId, module->assemblyId));
+    if (module->assemblyId == 0) {
+        return nullptr;
+    }
+    module->assemblyName = ToBytes(GetAssemblyName(info, module->assemblyId));
+    if (
+            this->filter.MatchesAssembly(module->assemblyName)
+            || this->waitFilter.MatchesAssembly(module->assemblyName)
+            || this->testFilter.MatchesAssembly(module->assemblyName)
+            || this->finalizerFilter.MatchesAssembly(module->assemblyName)
+            || this->startupFilter.MatchesAssembly(module->assemblyName)
+    ) {
+        this->Index(info, *module);
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    // Another thread may have raced us to it; keep whichever got in first.
+    auto inserted = this->modules.insert(std::make_pair(moduleId, module));
+    if (inserted.second) {
+        GetMemoryBudget().Charge(module->Footprint());
+    }
+    return inserted.first->second;
+}
+
+bool ModuleTable::ShouldHook(ICorProfilerInfo2& info, const ModuleInfo& module, mdToken token, MethodKind& kind) {
+    kind = MethodKind::Normal;
+    if (module.IsIndexed(token)) {
+        if (module.IsWait(token)) {
+            kind = MethodKind::Wait;
+        } else if (module.IsTest(token)) {
+            kind = MethodKind::Test;
+        } else if (module.IsFinalizer(token)) {
+            kind = MethodKind::Finalizer;
+        } else if (module.IsStartup(token)) {
+            kind = MethodKind::Startup;
+        }
+        return module.IsHooked(token);
+    }
+    if (
+            !this->filter.MatchesAssembly(module.assemblyName)
+            && !this->waitFilter.MatchesAssembly(module.assemblyName)
+            && !this->testFilter.MatchesAssembly(module.assemblyName)
+            && !this->finalizerFilter.MatchesAssembly(module.assemblyName)
+            && !this->startupFilter.MatchesAssembly(module.assemblyName)
+    ) {
+        return false;
+    }
+
+    OverheadScope scope(OverheadMetadata);
+    CComPtr<IMetaDataImport2> metaDataImport2;
+    HRESULT result = info.GetModuleMetaData(
+            module.moduleId,
+            ofRead,
+            IID_IMetaDataImport,
+            (IUnknown **) &metaDataImport2
+    );
+    if (FAILED(result)) {
+        printf("Error: GetModuleMetaData %x\n", result);
+        return false;
+    }
+    mdTypeDef classId;
+    std::string name = ToBytes(GetFunctionName(metaDataImport2, token, classId));
+    std::string type = ToBytes(GetFullTypeName(metaDataImport2, classId));
+    if (this->waitFilter.Matches(module.assemblyName, type, name)) {
+        kind = MethodKind::Wait;
+        return true;
+    }
+    if (this->IsTest(metaDataImport2, module.assemblyName, type, name, token)) {
+        kind = MethodKind::Test;
+        return true;
+    }
+    if (this->finalizerFilter.Matches(module.assemblyName, type, name)) {
+        kind = MethodKind::Finalizer;
+        return true;
+    }
+    if (this->startupFilter.Matches(module.assemblyName, type, name)) {
+        kind = MethodKind::Startup;
+        return true;
+    }
+    return this->filter.Matches(module.assemblyName, type, name);
+}
+
+bool ModuleTable::ShouldHookDynamic(const std::string& name) const {
+    std::string type = DynamicMethodTable::TypeName;
+    std::string prefix = type + "!" + type + "::";
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    return this->filter.Matches(type, type, name.substr(prefix.size()));
+}
+
+void ModuleTable::Remove(ModuleID moduleId) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->modules.find(moduleId);
+    if (found == this->modules.end()) {
+        return;
+    }
+    GetMemoryBudget().Release(found->second->Footprint());
+    this->modules.erase(found);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "CComPtr.h"
+#include "MethodFilter.h"
+#include "Profile.h"
+
+struct ModuleInfo
+{
+    ModuleID moduleId;
+    AssemblyID assemblyId;
+    std::string assemblyName;
+    std::string path;
+
+    // Index over the module's MethodDefs by RID, built once when the module
+    // loads: whether the filters select each method, its
+    // `Namespace.Type::Method` name and its signature hash. Only modules of
+    // assemblies a filter matches are indexed.
+    std::vector<uint64_t> hooked;
+    std::vector<uint64_t> waits;
+    std::vector<uint64_t> tests;
+    std::vector<uint64_t> finalizers;
+    std::vector<uint64_t> startups;
+    std::vector<uint32_t> nameOffsets;
+    std::string names;
+    std::vector<uint32_t> signatures;
+
+    bool IsIndexed(mdToken token) const;
+    bool IsHooked(mdToken token) const;
+    bool IsWait(mdToken token) const;
+    bool IsTest(mdToken token) const;
+    bool IsFinalizer(mdToken token) const;
+    bool IsStartup(mdToken token) const;
+    std::string MethodName(mdToken token) const;
+    uint32_t Signature(mdToken token) const;
+
+    // Bytes charged to the memory budget for this module.
+    size_t Footprint() const;
+};
+
+// Per-module facts looked up once per module instead of once per function.
+class ModuleTable
+{
+private:
+    std::mutex mutex;
+    std::unordered_map<ModuleID, std::shared_ptr<const ModuleInfo>> modules;
+    MethodFilter filter;
+    MethodFilter waitFilter;
+    MethodFilter testFilter;
+    MethodFilter finalizerFilter;
+    MethodFilter startupFilter;
+    std::vector<std::vector<WCHAR>> testAttributes;
+
+    void Index(ICorProfilerInfo2& info, ModuleInfo& module);
+    bool IsTest(
+            CComPtr<IMetaDataImport2>& metaDataImport2,
+            const std::string& assembly,
+            const std::string& type,
+            const std::string& method,
+            mdToken token
+    ) const;
+
+public:
+    // Set the filters later modules are indexed with; call before any
+    // module loads. Methods the wait filter selects are hooked as
+    // MethodKind::Wait.
+    void SetFilter(const MethodFilter& filter);
+    void SetWaitFilter(const MethodFilter& filter);
+    // Methods the test filter selects are hooked as MethodKind::Test if they
+    // carry one of the `;`-separated `attributes`, or any of them when
+    // `attributes` is empty.
+    void SetTestFilter(const MethodFilter& filter, const std::string& attributes);
+    // Methods the finalizer filter selects are hooked as
+    // MethodKind::Finalizer.
+    void SetFinalizerFilter(const MethodFilter& filter);
+    // Methods the startup filter selects are hooked as MethodKind::Startup.
+    void SetStartupFilter(const MethodFilter& filter);
+
+    // Returns the info for `moduleId`, querying the runtime and indexing the
+    // module's methods on first use. Returns nullptr when the runtime does
+    // not know the module.
+    std::shared_ptr<const ModuleInfo> Get(ICorProfilerInfo2& info, ModuleID moduleId);
+
+    // Whether the method `token` of `module` gets the ELT hooks, and as what
+    // kind. A bit test for indexed methods; methods defined after the module
+    // loaded are looked up one by one.
+    bool ShouldHook(ICorProfilerInfo2& info, const ModuleInfo& module, mdToken token, MethodKind& kind);
+
+    // Whether the filter selects the dynamic method named `name`, which
+    // belongs to no module; see DynamicMethodTable.
+    bool ShouldHookDynamic(const std::string& name) const;
+
+    // Forgets an unloaded module; its ModuleID may be reused.
+    void Remove(ModuleID moduleId);
+};
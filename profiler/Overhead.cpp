@@ -0,0 +1,111 @@
+#include "Overhead.h"
+#include "Clock.h"
+#include "ThreadState.h"
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+const char* const OverheadKindNames[OverheadKindCount] = {
+    "mapper",
+    "hooks",
+    "metadata",
+    "drain",
+};
+
+// Cheaper than NowNs(); converted to nanoseconds only when reported.
+static inline uint64_t ReadTicks() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return NowNs();
+#endif
+}
+
+// Reference points for converting ticks, taken when the library loads.
+static const uint64_t StartTicks = ReadTicks();
+static const uint64_t StartNs = NowNs();
+
+static std::atomic<uint64_t> RetiredTicks[OverheadKindCount];
+static std::atomic<uint64_t> RetiredCalls[OverheadKindCount];
+static std::atomic<uint64_t> TraceBytes(0);
+
+static void Add(std::atomic<uint64_t>& counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+OverheadCounters::OverheadCounters() : active(-1), activeStart(0)
+{
+    for (int i = 0; i < OverheadKindCount; i++) {
+        this->ticks[i].store(0, std::memory_order_relaxed);
+        this->calls[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+OverheadScope::OverheadScope(OverheadKind kind) :
+    counters(GetThreadState().overhead),
+    previous(counters.active)
+{
+    uint64_t now = ReadTicks();
+    if (this->previous >= 0) {
+        Add(this->counters.ticks[this->previous], now - this->counters.activeStart);
+    }
+    Add(this->counters.calls[kind], 1);
+    this->counters.active = kind;
+    this->counters.activeStart = now;
+}
+
+OverheadScope::~OverheadScope()
+{
+    uint64_t now = ReadTicks();
+    Add(this->counters.ticks[this->counters.active], now - this->counters.activeStart);
+    this->counters.active = this->previous;
+    this->counters.activeStart = now;
+}
+
+void AddTraceBytes(uint64_t bytes) {
+    TraceBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void RetireOverhead(const OverheadCounters& counters) {
+    for (int i = 0; i < OverheadKindCount; i++) {
+        RetiredTicks[i].fetch_add(counters.ticks[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        RetiredCalls[i].fetch_add(counters.calls[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+OverheadTotals CollectOverhead() {
+    uint64_t ticks[OverheadKindCount];
+    OverheadTotals totals;
+    // The retired totals are read under the registry lock as well, so that a
+    // thread exiting meanwhile is counted exactly once.
+    bool retiredRead = false;
+    auto readRetired = [&]() {
+        for (int i = 0; i < OverheadKindCount; i++) {
+            ticks[i] = RetiredTicks[i].load(std::memory_order_relaxed);
+            totals.calls[i] = RetiredCalls[i].load(std::memory_order_relaxed);
+        }
+        retiredRead = true;
+    };
+    ForEachThreadState([&](ThreadState& state) {
+        if (!retiredRead) {
+            readRetired();
+        }
+        for (int i = 0; i < OverheadKindCount; i++) {
+            ticks[i] += state.overhead.ticks[i].load(std::memory_order_relaxed);
+            totals.calls[i] += state.overhead.calls[i].load(std::memory_order_relaxed);
+        }
+    });
+    if (!retiredRead) {
+        readRetired();
+    }
+
+    uint64_t elapsedTicks = ReadTicks() - StartTicks;
+    uint64_t elapsedNs = NowNs() - StartNs;
+    double nsPerTick = elapsedTicks == 0 ? 1.0 : (double) elapsedNs / (double) elapsedTicks;
+    for (int i = 0; i < OverheadKindCount; i++) {
+        totals.ns[i] = (uint64_t) ((double) ticks[i] * nsPerTick);
+    }
+    totals.traceBytes = TraceBytes.load(std::memory_order_relaxed);
+    return totals;
+}
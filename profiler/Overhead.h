@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// What the profiler spends its own time on.
+enum OverheadKind
+{
+    // _FunctionIDMapper2, on the JIT path.
+    OverheadMapper,
+    // The ELT hooks and the code transition callbacks.
+    OverheadHooks,
+    // Metadata lookups: module indexing and name resolution.
+    OverheadMetadata,
+    // Handing trace chunks to the sink, on the drain thread.
+    OverheadDrain,
+    OverheadKindCount,
+};
+
+// Per-thread cost counters, owned by ThreadState. Only the owning thread
+// writes them; relaxed atomics let the report read them meanwhile.
+struct OverheadCounters
+{
+    OverheadCounters();
+
+    std::atomic<uint64_t> ticks[OverheadKindCount];
+    std::atomic<uint64_t> calls[OverheadKindCount];
+
+    // The innermost open OverheadScope on this thread, or -1.
+    int active;
+    uint64_t activeStart;
+};
+
+// Times a block of profiler code with the TSC. Scopes nest exclusively: an
+// inner scope, such as metadata resolution within the mapper, pauses the
+// outer one, so no time is counted twice.
+class OverheadScope
+{
+private:
+    OverheadCounters& counters;
+    int previous;
+
+public:
+    explicit OverheadScope(OverheadKind kind);
+    ~OverheadScope();
+};
+
+struct OverheadTotals
+{
+    uint64_t ns[OverheadKindCount];
+    uint64_t calls[OverheadKindCount];
+    uint64_t traceBytes;
+};
+
+extern const char* const OverheadKindNames[OverheadKindCount];
+
+// Counts bytes the trace sinks wrote out.
+void AddTraceBytes(uint64_t bytes);
+
+// Adds up the counters of every live thread and of the threads that exited.
+OverheadTotals CollectOverhead();
+
+// Folds the counters of an exiting thread into the totals.
+void RetireOverhead(const OverheadCounters& counters);
@@ -0,0 +1,820 @@
+#include "Profile.h"
+#include "Clock.h"
+#include "MemoryBudget.h"
+#include "Metadata.h"
+#include "Overhead.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+MethodStats::MethodStats(FunctionID functionId, ModuleID moduleId, mdToken token) :
+    functionId(functionId),
+    moduleId(moduleId),
+    token(token),
+    kind(MethodKind::Normal),
+    calls(0),
+    totalNs(0),
+    maxNs(0),
+    signature(0),
+    arguments(nullptr),
+    counters(nullptr),
+    name(nullptr)
+{
+}
+
+MethodStats::~MethodStats()
+{
+    delete this->arguments.load();
+    MethodCounters* counters = this->counters.load();
+    if (counters != nullptr) {
+        GetMemoryBudget().Release(sizeof(MethodCounters));
+        delete counters;
+    }
+    delete this->name.load();
+}
+
+void MethodStats::Record(uint64_t elapsedNs) {
+    this->totalNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+    AtomicMax(this->maxNs, elapsedNs);
+    this->latency.Record(elapsedNs);
+}
+
+bool MethodStats::HasName() const {
+    return this->name.load(std::memory_order_acquire) != nullptr;
+}
+
+std::string MethodStats::Name() const {
+    std::string* resolved = this->name.load(std::memory_order_acquire);
+    if (resolved != nullptr) {
+        return *resolved;
+    }
+    std::ostringstream placeholder;
+    placeholder << "?!" << std::hex << this->moduleId << ":" << this->token;
+    return placeholder.str();
+}
+
+void MethodStats::SetName(const std::string& name) {
+    std::string* resolved = new std::string(name);
+    std::string* expected = nullptr;
+    if (this->name.compare_exchange_strong(expected, resolved, std::memory_order_acq_rel)) {
+        GetMemoryBudget().Charge(sizeof(std::string) + name.size());
+    } else {
+        delete resolved;
+    }
+}
+
+MethodTable::~MethodTable()
+{
+    for (MethodStats* method : this->methods) {
+        delete method;
+    }
+}
+
+MethodStats* MethodTable::Add(FunctionID functionId, ModuleID moduleId, mdToken token, MethodKind kind) {
+    if (!GetMemoryBudget().TryReserve(sizeof(MethodStats))) {
+        return nullptr;
+    }
+    MethodStats* method = new MethodStats(functionId, moduleId, token);
+    method->kind = kind;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->methods.push_back(method);
+    this->byFunctionId[functionId] = method;
+    return method;
+}
+
+MethodStats* MethodTable::Find(FunctionID functionId) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->byFunctionId.find(functionId);
+    return found == this->byFunctionId.end() ? nullptr : found->second;
+}
+
+std::vector<MethodStats*> MethodTable::List() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->methods;
+}
+
+TestStats::TestStats(MethodStats* method) :
+    method(method),
+    runs(0),
+    failures(0),
+    totalNs(0),
+    maxNs(0),
+    allocatedBytes(0),
+    allocatedObjects(0),
+    gcCount(0),
+    gcNs(0)
+{
+}
+
+TestTable::~TestTable()
+{
+    for (TestStats* test : this->tests) {
+        delete test;
+    }
+}
+
+TestStats* TestTable::Get(MethodStats* method) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->byMethod.find(method);
+    if (found != this->byMethod.end()) {
+        return found->second;
+    }
+    if (!GetMemoryBudget().TryReserve(sizeof(TestStats))) {
+        return nullptr;
+    }
+    TestStats* test = new TestStats(method);
+    this->tests.push_back(test);
+    this->byMethod[method] = test;
+    return test;
+}
+
+std::vector<TestStats*> TestTable::List() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->tests;
+}
+
+bool WaitTable::Record(
+        MethodStats* method,
+        ClassID lockClass,
+        FunctionID caller,
+        uint64_t elapsedNs,
+        const std::function<std::string()>& callerName
+) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto key = std::make_tuple(method, lockClass, caller);
+    auto found = this->sites.find(key);
+    if (found == this->sites.end()) {
+        std::string name = callerName();
+        if (!GetMemoryBudget().TryReserve(sizeof(WaitSite) + name.size())) {
+            return false;
+        }
+        WaitSite site;
+        site.method = method;
+        site.lockClass = lockClass;
+        site.caller = caller;
+        site.callerName = name;
+        site.waits = 0;
+        site.totalNs = 0;
+        site.maxNs = 0;
+        found = this->sites.insert(std::make_pair(key, site)).first;
+    }
+    found->second.waits++;
+    found->second.totalNs += elapsedNs;
+    found->second.maxNs = std::max(found->second.maxNs, elapsedNs);
+    return true;
+}
+
+std::vector<WaitSite> WaitTable::List() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<WaitSite> list;
+    for (auto& site : this->sites) {
+        list.push_back(site.second);
+    }
+    return list;
+}
+
+const char* const DynamicMethodTable::TypeName = "<Dynamic>";
+
+void DynamicMethodTable::Started(FunctionID functionId, const std::string& name, LPCBYTE il, ULONG ilSize, uint64_t now) {
+    // FNV-1a, as for signatures.
+    uint32_t hash = 2166136261u;
+    for (ULONG i = 0; i < ilSize; i++) {
+        hash = (hash ^ il[i]) * 16777619u;
+    }
+    std::ostringstream synthetic;
+    synthetic << TypeName << "!" << TypeName << "::" << name << "#" << std::hex << std::setw(8) << std::setfill('0') << hash;
+
+    Pending compilation;
+    compilation.name = synthetic.str();
+    compilation.ilSize = ilSize;
+    compilation.startNs = now;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->names.find(functionId) == this->names.end()) {
+        if (!GetMemoryBudget().TryReserve(sizeof(Pending) + 2 * compilation.name.size())) {
+            return;
+        }
+    }
+    this->names[functionId] = compilation.name;
+    this->pending[functionId] = compilation;
+}
+
+void DynamicMethodTable::Finished(FunctionID functionId, HRESULT status, uint64_t now) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->pending.find(functionId);
+    if (found == this->pending.end()) {
+        return;
+    }
+    Pending compilation = found->second;
+    this->pending.erase(found);
+
+    auto method = this->methods.find(compilation.name);
+    if (method == this->methods.end()) {
+        if (!GetMemoryBudget().TryReserve(sizeof(DynamicMethodStats) + compilation.name.size())) {
+            return;
+        }
+        DynamicMethodStats stats;
+        stats.name = compilation.name;
+        stats.ilSize = compilation.ilSize;
+        stats.compilations = 0;
+        stats.failures = 0;
+        stats.jitNs = 0;
+        stats.maxJitNs = 0;
+        method = this->methods.insert(std::make_pair(compilation.name, stats)).first;
+    }
+    uint64_t elapsed = now - compilation.startNs;
+    method->second.compilations++;
+    if (FAILED(status)) {
+        method->second.failures++;
+    }
+    method->second.jitNs += elapsed;
+    method->second.maxJitNs = std::max(method->second.maxJitNs, elapsed);
+}
+
+bool DynamicMethodTable::Find(FunctionID functionId, std::string& name) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->names.find(functionId);
+    if (found == this->names.end()) {
+        return false;
+    }
+    name = found->second;
+    return true;
+}
+
+std::vector<DynamicMethodStats> DynamicMethodTable::List() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<DynamicMethodStats> list;
+    for (const auto& entry : this->methods) {
+        list.push_back(entry.second);
+    }
+    return list;
+}
+
+void FinalizationTable::Queued(ClassID classId, uint64_t now) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->types.find(classId);
+    if (found == this->types.end()) {
+        if (!GetMemoryBudget().TryReserve(sizeof(Entry) + MaxPending * sizeof(uint64_t))) {
+            return;
+        }
+        Entry entry;
+        entry.stats.classId = classId;
+        entry.stats.queued = 0;
+        entry.stats.finalized = 0;
+        entry.stats.totalWaitNs = 0;
+        entry.stats.maxWaitNs = 0;
+        found = this->types.insert(std::make_pair(classId, entry)).first;
+    }
+    Entry& entry = found->second;
+    entry.stats.queued++;
+    if (entry.queuedNs.size() == MaxPending) {
+        entry.queuedNs.pop_front();
+    }
+    entry.queuedNs.push_back(now);
+}
+
+void FinalizationTable::Finalized(ClassID classId, uint64_t now) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->types.find(classId);
+    if (found == this->types.end()) {
+        return;
+    }
+    Entry& entry = found->second;
+    entry.stats.finalized++;
+    // Objects queued before the profiler attached have no queue time.
+    if (entry.queuedNs.empty()) {
+        return;
+    }
+    uint64_t elapsed = now - entry.queuedNs.front();
+    entry.queuedNs.pop_front();
+    entry.stats.totalWaitNs += elapsed;
+    entry.stats.maxWaitNs = std::max(entry.stats.maxWaitNs, elapsed);
+}
+
+std::vector<FinalizationStats> FinalizationTable::List() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<FinalizationStats> list;
+    for (const auto& entry : this->types) {
+        list.push_back(entry.second.stats);
+    }
+    return list;
+}
+
+// Live handles tracked at once.
+static const size_t HandleCapacity = 1 << 16;
+
+HandleStats::HandleStats() : live(HandleCapacity), created(4096), destroyed(4096), untracked(0)
+{
+}
+
+void HandleStats::Created(GCHandleID handleId, ClassID classId) {
+    uintptr_t key = classId != 0 ? (uintptr_t) classId : NoClass;
+    this->live.Insert((uintptr_t) handleId, key);
+    this->created.Add(key, 1);
+}
+
+void HandleStats::Destroyed(GCHandleID handleId) {
+    uintptr_t key;
+    if (!this->live.Remove((uintptr_t) handleId, key)) {
+        this->untracked.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    this->destroyed.Add(key, 1);
+}
+
+StartupTable::StartupTable() :
+    running(true),
+    endedBy(nullptr),
+    endNs(0),
+    loadNs(0),
+    criticalLoadNs(0)
+{
+}
+
+bool StartupTable::Running() const {
+    return this->running.load(std::memory_order_acquire);
+}
+
+void StartupTable::Record(
+        LoadKind kind,
+        const std::string& name,
+        bool failed,
+        bool outermost,
+        uint64_t totalNs,
+        uint64_t selfNs,
+        uint64_t sinceStartNs
+) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (outermost) {
+        this->loadNs += totalNs;
+    }
+    auto found = this->loads.find(name);
+    if (found == this->loads.end()) {
+        if (!GetMemoryBudget().TryReserve(sizeof(LoadStats) + 2 * name.size())) {
+            return;
+        }
+        LoadStats stats;
+        stats.kind = kind;
+        stats.name = name;
+        stats.count = 0;
+        stats.failures = 0;
+        stats.totalNs = 0;
+        stats.selfNs = 0;
+        stats.firstNs = sinceStartNs;
+        found = this->loads.insert(std::make_pair(name, stats)).first;
+    }
+    LoadStats& stats = found->second;
+    stats.count++;
+    if (failed) {
+        stats.failures++;
+    }
+    stats.totalNs += totalNs;
+    stats.selfNs += selfNs;
+    stats.firstNs = std::min(stats.firstNs, sinceStartNs);
+}
+
+void StartupTable::End(MethodStats* method, uint64_t sinceStartNs, uint64_t threadLoadNs) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->running.load(std::memory_order_relaxed)) {
+        return;
+    }
+    this->endedBy = method;
+    this->endNs = sinceStartNs;
+    this->criticalLoadNs = threadLoadNs;
+    this->running.store(false, std::memory_order_release);
+}
+
+bool StartupTable::Ended(MethodStats*& method, uint64_t& sinceStartNs, uint64_t& criticalLoadNs) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->running.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    method = this->endedBy;
+    sinceStartNs = this->endNs;
+    criticalLoadNs = this->criticalLoadNs;
+    return true;
+}
+
+uint64_t StartupTable::LoadNs() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->loadNs;
+}
+
+std::vector<LoadStats> StartupTable::List() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<LoadStats> list;
+    for (const auto& entry : this->loads) {
+        list.push_back(entry.second);
+    }
+    return list;
+}
+
+GcStats::GcStats() : induced(0), totalNs(0), maxNs(0), startNs(0)
+{
+    for (int i = 0; i < MaxGenerations; i++) {
+        this->collections[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void GcStats::Started(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason, uint64_t now) {
+    // Count each collection once, under the oldest generation it condemned.
+    int generation = 0;
+    for (int i = 0; i < cGenerations && i < MaxGenerations; i++) {
+        if (generationCollected[i]) {
+            generation = i;
+        }
+    }
+    this->collections[generation].fetch_add(1, std::memory_order_relaxed);
+    if (reason == COR_PRF_GC_INDUCED) {
+        this->induced.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->startNs = now;
+}
+
+void GcStats::Finished(uint64_t now) {
+    if (this->startNs == 0) {
+        return;
+    }
+    uint64_t elapsed = now - this->startNs;
+    this->totalNs.fetch_add(elapsed, std::memory_order_relaxed);
+    AtomicMax(this->maxNs, elapsed);
+    this->startNs = 0;
+}
+
+DropStats::DropStats() : arguments(0), events(0), methods(0)
+{
+}
+
+// Slots in each of the interop tables.
+static const size_t InteropCapacity = 1024;
+
+static std::string NewInstance() {
+    uint64_t wallNs = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+    std::random_device random;
+    std::ostringstream out;
+    out << std::hex << std::setfill('0') << std::setw(16) << wallNs << '-' << std::setw(8) << (uint32_t) random();
+    return out.str();
+}
+
+Profile::Profile() :
+    startNs(NowNs()),
+    instance(NewInstance()),
+    exceptions(0),
+    allocations(4096),
+    allocatedBytes(4096),
+    pinvokeCalls(InteropCapacity),
+    pinvokeNs(InteropCapacity),
+    reverseCalls(InteropCapacity),
+    reverseNs(InteropCapacity)
+{
+    GetMemoryBudget().Charge(
+            sizeof(Profile)
+            + (3 * 4096 + 4 * InteropCapacity) * (sizeof(uintptr_t) + sizeof(uint64_t))
+    );
+}
+
+static std::string ClassName(ICorProfilerInfo2& info, Profile& profile, ClassID classId) {
+    std::lock_guard<std::mutex> lock(profile.classNamesMutex);
+    auto found = profile.classNames.find(classId);
+    if (found != profile.classNames.end()) {
+        return found->second;
+    }
+    std::string name = ToBytes(GetClassName(info, classId));
+    profile.classNames[classId] = name;
+    return name;
+}
+
+// Names functions that are not hooked, and so have no MethodStats, such as
+// P/Invoke declarations.
+static std::string FunctionName(ICorProfilerInfo2& info, Profile& profile, FunctionID functionId) {
+    std::lock_guard<std::mutex> lock(profile.functionNamesMutex);
+    auto found = profile.functionNames.find(functionId);
+    if (found != profile.functionNames.end()) {
+        return found->second;
+    }
+    OverheadScope scope(OverheadMetadata);
+    std::string name;
+    // Dynamic methods have no metadata to look up.
+    if (!profile.dynamicMethods.Find(functionId, name)) {
+        name = "?";
+        ModuleID moduleId;
+        mdToken token;
+        HRESULT result = info.GetFunctionInfo2(functionId, 0, NULL, &moduleId, &token, 0, NULL, NULL);
+        if (SUCCEEDED(result)) {
+            AssemblyID assemblyId = 0;
+            GetModulePath(info, moduleId, assemblyId);
+            name = ToBytes(GetAssemblyName(info, assemblyId)) + "!" + ToBytes(GetTypeAndMethodName(info, functionId));
+        }
+    }
+    profile.functionNames[functionId] = name;
+    return name;
+}
+
+const char* LoadKindName(LoadKind kind) {
+    switch (kind) {
+        case LoadKind::Assembly: return "assembly";
+        case LoadKind::Class: return "class";
+        case LoadKind::Generic: return "generic";
+    }
+    return "?";
+}
+
+static void FormatInterop(
+        std::ostringstream& out,
+        ICorProfilerInfo2& info,
+        Profile& profile,
+        const char* kind,
+        CounterTable& calls,
+        CounterTable& nanoseconds
+) {
+    calls.ForEach([&](uintptr_t functionId, uint64_t count) {
+        out << kind << "\tmethod=" << FunctionName(info, profile, (FunctionID) functionId)
+            << "\tcalls=" << count
+            << "\ttotal_ns=" << nanoseconds.Get(functionId)
+            << "\n";
+    });
+}
+
+// One `counters` line per method read with hardware counters. Counts include
+// callees. `ipc` is instructions per cycle, and the miss rates are per
+// thousand instructions.
+static void FormatCounters(std::ostringstream& out, const std::string& name, MethodCounters& counters) {
+    uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+    if (calls == 0) {
+        return;
+    }
+    uint64_t totals[HardwareCounterCount];
+    out << "counters\tmethod=" << name << "\tcalls=" << calls;
+    for (int i = 0; i < HardwareCounterCount; i++) {
+        totals[i] = counters.totals[i].load(std::memory_order_relaxed);
+        out << "\t" << HardwareCounterNames[i] << "=" << totals[i];
+    }
+    double cycles = (double) totals[CounterCycles];
+    double instructions = (double) totals[CounterInstructions];
+    out << std::fixed << std::setprecision(3)
+        << "\tipc=" << (cycles > 0 ? instructions / cycles : 0.0)
+        << "\tcache_mpki=" << (instructions > 0 ? totals[CounterCacheMisses] * 1000.0 / instructions : 0.0)
+        << "\tbranch_mpki=" << (instructions > 0 ? totals[CounterBranchMisses] * 1000.0 / instructions : 0.0)
+        << std::defaultfloat << "\n";
+}
+
+// One `argument` line per decoded parameter of a method: magnitude
+// percentiles for integers, and the most frequent values as
+// `value:count:error` pairs, where the true count lies in [count - error,
+// count].
+static void FormatArguments(std::ostringstream& out, const std::string& name, ArgumentSketches& sketches) {
+    uint64_t counts[LatencyHistogram::BucketCount];
+    for (size_t i = 0; i < sketches.arguments.size(); i++) {
+        ArgumentSketch* sketch = sketches.arguments[i];
+        if (sketch == nullptr) {
+            continue;
+        }
+        out << "argument\tmethod=" << name
+            << "\tindex=" << i
+            << "\ttype=" << ArgumentTypeName(sketch->type)
+            << "\tcount=" << sketch->count.load(std::memory_order_relaxed);
+        if (sketch->type == ArgumentType::Signed || sketch->type == ArgumentType::Unsigned) {
+            sketch->magnitudes.Snapshot(counts);
+            out << "\tnegative=" << sketch->negatives.load(std::memory_order_relaxed)
+                << "\tp50=" << LatencyHistogram::Percentile(counts, 0.50)
+                << "\tp90=" << LatencyHistogram::Percentile(counts, 0.90)
+                << "\tp99=" << LatencyHistogram::Percentile(counts, 0.99);
+        }
+        std::vector<TopK::Entry> top;
+        {
+            std::lock_guard<std::mutex> lock(sketches.mutex);
+            top = sketch->top.List();
+        }
+        out << "\ttop=";
+        for (size_t j = 0; j < top.size(); j++) {
+            out << (j == 0 ? "" : ",") << sketch->Label(top[j]) << ":" << top[j].count << ":" << top[j].error;
+        }
+        out << "\n";
+    }
+}
+
+std::string FormatProfile(ICorProfilerInfo2& info, Profile& profile) {
+    std::ostringstream out;
+
+    out << "profile\tpid=" << getpid()
+        << "\tinstance=" << profile.instance
+        << "\tuptime_ns=" << NowNs() - profile.startNs << "\n";
+
+    uint64_t counts[LatencyHistogram::BucketCount];
+    for (MethodStats* method : profile.methods.List()) {
+        uint64_t calls = method->calls.load(std::memory_order_relaxed);
+        if (calls == 0) {
+            continue;
+        }
+        uint64_t maxNs = method->maxNs.load(std::memory_order_relaxed);
+        method->latency.Snapshot(counts);
+        // The signature is published along with the name.
+        std::string name = method->Name();
+        uint32_t signature = method->signature;
+
+        out << "method\tid=" << std::hex << method->functionId << std::dec
+            << "\tname=" << name
+            << "\tsig=" << std::hex << std::setw(8) << std::setfill('0') << signature << std::setfill(' ') << std::dec
+            << "\tcalls=" << calls
+            << "\ttotal_ns=" << method->totalNs.load(std::memory_order_relaxed)
+            << "\tp50_ns=" << std::min(LatencyHistogram::Percentile(counts, 0.50), maxNs)
+            << "\tp90_ns=" << std::min(LatencyHistogram::Percentile(counts, 0.90), maxNs)
+            << "\tp99_ns=" << std::min(LatencyHistogram::Percentile(counts, 0.99), maxNs)
+            << "\tmax_ns=" << maxNs
+            << "\thist=";
+        // Sparse `bucket:count` pairs; bucket bounds follow LatencyHistogram.
+        bool first = true;
+        for (int i = 0; i < LatencyHistogram::BucketCount; i++) {
+            if (counts[i] != 0) {
+                out << (first ? "" : ",") << i << ":" << counts[i];
+                first = false;
+            }
+        }
+        out << "\n";
+
+        ArgumentSketches* sketches = method->arguments.load(std::memory_order_acquire);
+        if (sketches != nullptr) {
+            FormatArguments(out, name, *sketches);
+        }
+        MethodCounters* counters = method->counters.load(std::memory_order_acquire);
+        if (counters != nullptr) {
+            FormatCounters(out, name, *counters);
+        }
+    }
+
+    std::vector<WaitSite> waits = profile.waits.List();
+    std::sort(waits.begin(), waits.end(), [](const WaitSite& a, const WaitSite& b) {
+        return a.totalNs > b.totalNs;
+    });
+    for (const WaitSite& site : waits) {
+        out << "wait\tmethod=" << site.method->Name()
+            << "\tlock=" << (site.lockClass == 0 ? std::string("?") : ClassName(info, profile, site.lockClass))
+            << "\tsite=" << site.callerName
+            << "\twaits=" << site.waits
+            << "\ttotal_ns=" << site.totalNs
+            << "\tmax_ns=" << site.maxNs
+            << "\n";
+    }
+
+    std::vector<DynamicMethodStats> dynamicMethods = profile.dynamicMethods.List();
+    std::sort(dynamicMethods.begin(), dynamicMethods.end(), [](const DynamicMethodStats& a, const DynamicMethodStats& b) {
+        return a.jitNs > b.jitNs;
+    });
+    for (const DynamicMethodStats& method : dynamicMethods) {
+        out << "dynamic\tname=" << method.name
+            << "\til_size=" << method.ilSize
+            << "\tcompilations=" << method.compilations
+            << "\tfailures=" << method.failures
+            << "\tjit_ns=" << method.jitNs
+            << "\tmax_jit_ns=" << method.maxJitNs
+            << "\n";
+    }
+
+    // Sorted on a snapshot, since running tests keep moving the totals.
+    std::vector<std::pair<uint64_t, TestStats*>> tests;
+    for (TestStats* test : profile.tests.List()) {
+        tests.push_back(std::make_pair(test->totalNs.load(std::memory_order_relaxed), test));
+    }
+    std::sort(tests.begin(), tests.end(), [](const std::pair<uint64_t, TestStats*>& a, const std::pair<uint64_t, TestStats*>& b) {
+        return a.first > b.first;
+    });
+    for (const std::pair<uint64_t, TestStats*>& entry : tests) {
+        TestStats* test = entry.second;
+        out << "test\tname=" << test->method->Name()
+            << "\truns=" << test->runs.load(std::memory_order_relaxed)
+            << "\tfailures=" << test->failures.load(std::memory_order_relaxed)
+            << "\ttotal_ns=" << entry.first
+            << "\tmax_ns=" << test->maxNs.load(std::memory_order_relaxed)
+            << "\talloc_bytes=" << test->allocatedBytes.load(std::memory_order_relaxed)
+            << "\talloc_objects=" << test->allocatedObjects.load(std::memory_order_relaxed)
+            << "\tgc_count=" << test->gcCount.load(std::memory_order_relaxed)
+            << "\tgc_ns=" << test->gcNs.load(std::memory_order_relaxed)
+            << "\n";
+    }
+
+    std::vector<FinalizationStats> finalization = profile.finalization.List();
+    std::sort(finalization.begin(), finalization.end(), [](const FinalizationStats& a, const FinalizationStats& b) {
+        return a.totalWaitNs > b.totalWaitNs;
+    });
+    for (const FinalizationStats& type : finalization) {
+        out << "finalizer\ttype=" << ClassName(info, profile, type.classId)
+            << "\tqueued=" << type.queued
+            << "\tfinalized=" << type.finalized
+            << "\tpending=" << (type.queued > type.finalized ? type.queued - type.finalized : 0)
+            << "\ttotal_wait_ns=" << type.totalWaitNs
+            << "\tmax_wait_ns=" << type.maxWaitNs
+            << "\n";
+    }
+
+    // Handles created while the table pairing them with their type was full
+    // stay live under that type; their destroys go to `<untracked>`, whose
+    // `created` counts them, so the two can be told apart from handles that
+    // predate the profiler.
+    HandleStats& handles = profile.handles;
+    handles.created.ForEach([&](uintptr_t key, uint64_t created) {
+        uint64_t destroyed = handles.destroyed.Get(key);
+        out << "handles\ttype="
+            << (key == HandleStats::NoClass ? std::string("<empty>") : ClassName(info, profile, (ClassID) key))
+            << "\tcreated=" << created
+            << "\tdestroyed=" << destroyed
+            << "\tlive=" << (created > destroyed ? created - destroyed : 0)
+            << "\n";
+    });
+    if (handles.created.Overflow() != 0 || handles.destroyed.Overflow() != 0) {
+        out << "handles\ttype=<overflow>"
+            << "\tcreated=" << handles.created.Overflow()
+            << "\tdestroyed=" << handles.destroyed.Overflow()
+            << "\n";
+    }
+    uint64_t untracked = handles.untracked.load(std::memory_order_relaxed);
+    uint64_t unpaired = handles.live.Overflow();
+    if (untracked != 0 || unpaired != 0) {
+        out << "handles\ttype=<untracked>\tcreated=" << unpaired << "\tdestroyed=" << untracked << "\n";
+    }
+
+    // `critical_load_ns` is the part of `load_ns` spent on the thread whose
+    // call ended startup. Without such a call, startup is still running.
+    std::vector<LoadStats> loads = profile.startup.List();
+    MethodStats* endedBy = nullptr;
+    uint64_t startupNs = 0;
+    uint64_t criticalLoadNs = 0;
+    bool ended = profile.startup.Ended(endedBy, startupNs, criticalLoadNs);
+    if (ended || !loads.empty()) {
+        out << "startup\tended_by=" << (endedBy != nullptr ? endedBy->Name() : std::string("?"))
+            << "\tend_ns=" << startupNs
+            << "\tload_ns=" << profile.startup.LoadNs()
+            << "\tcritical_load_ns=" << criticalLoadNs
+            << "\n";
+    }
+    std::sort(loads.begin(), loads.end(), [](const LoadStats& a, const LoadStats& b) {
+        return a.selfNs > b.selfNs;
+    });
+    for (const LoadStats& load : loads) {
+        out << "load\tkind=" << LoadKindName(load.kind)
+            << "\tname=" << load.name
+            << "\tcount=" << load.count
+            << "\tfailures=" << load.failures
+            << "\ttotal_ns=" << load.totalNs
+            << "\tself_ns=" << load.selfNs
+            << "\tfirst_ns=" << load.firstNs
+            << "\n";
+    }
+
+    out << "gc";
+    for (int i = 0; i < GcStats::MaxGenerations; i++) {
+        out << "\tgen" << i << "=" << profile.gc.collections[i].load(std::memory_order_relaxed);
+    }
+    out << "\tinduced=" << profile.gc.induced.load(std::memory_order_relaxed)
+        << "\ttotal_ns=" << profile.gc.totalNs.load(std::memory_order_relaxed)
+        << "\tmax_ns=" << profile.gc.maxNs.load(std::memory_order_relaxed)
+        << "\n";
+
+    OverheadTotals overhead = CollectOverhead();
+    out << "overhead";
+    for (int i = 0; i < OverheadKindCount; i++) {
+        out << "\t" << OverheadKindNames[i] << "_ns=" << overhead.ns[i]
+            << "\t" << OverheadKindNames[i] << "_calls=" << overhead.calls[i];
+    }
+    out << "\ttrace_bytes=" << overhead.traceBytes << "\n";
+
+    MemoryBudget& budget = GetMemoryBudget();
+    out << "memory\tlimit=" << budget.Limit()
+        << "\tused=" << budget.Used()
+        << "\targuments_dropped=" << profile.drops.arguments.load(std::memory_order_relaxed)
+        << "\tevents_dropped=" << profile.drops.events.load(std::memory_order_relaxed)
+        << "\tmethods_dropped=" << profile.drops.methods.load(std::memory_order_relaxed)
+        << "\n";
+
+    // `bytes` is only known when every allocation is seen, with `tests`.
+    profile.allocations.ForEach([&](uintptr_t classId, uint64_t objects) {
+        out << "alloc\tclass=" << ClassName(info, profile, (ClassID) classId) << "\tobjects=" << objects;
+        uint64_t bytes = profile.allocatedBytes.Get(classId);
+        if (bytes != 0) {
+            out << "\tbytes=" << bytes;
+        }
+        out << "\n";
+    });
+    if (profile.allocations.Overflow() != 0) {
+        out << "alloc\tclass=<overflow>\tobjects=" << profile.allocations.Overflow();
+        if (profile.allocatedBytes.Overflow() != 0) {
+            out << "\tbytes=" << profile.allocatedBytes.Overflow();
+        }
+        out << "\n";
+    }
+
+    // `total_ns` is time spent in native code for P/Invokes, and in managed
+    // code for reverse P/Invokes.
+    FormatInterop(out, info, profile, "pinvoke", profile.pinvokeCalls, profile.pinvokeNs);
+    FormatInterop(out, info, profile, "reverse_pinvoke", profile.reverseCalls, profile.reverseNs);
+
+    out << "end\n";
+    return out.str();
+}
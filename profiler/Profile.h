@@ -0,0 +1,411 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+#include "ArgumentSketch.h"
+#include "CounterTable.h"
+#include "HardwareCounters.h"
+#include "HandleTable.h"
+#include "Histogram.h"
+
+// Why a method is hooked, which decides what its hooks record on top of the
+// latency stats.
+enum class MethodKind : uint8_t
+{
+    Normal,
+    // A blocking entry point such as Monitor.Enter: slow calls also go to the
+    // WaitTable.
+    Wait,
+    // A test method: each outermost call is a test run, see TestTable.
+    Test,
+    // A Finalize override: outermost calls end a wait in the
+    // FinalizationTable.
+    Finalizer,
+    // The first call of any such method ends startup, see StartupTable.
+    Startup,
+};
+
+// Live aggregates for one hooked method. The address of this record is
+// returned by the function ID mapper as the client ID, so the ELT hooks get
+// it directly and never have to look anything up.
+//
+// Only ids are known when the method is hooked; the Symbolizer fills in the
+// name later, and only for methods that end up in some output.
+struct MethodStats
+{
+    MethodStats(FunctionID functionId, ModuleID moduleId, mdToken token);
+    ~MethodStats();
+
+    FunctionID functionId;
+    ModuleID moduleId;
+    mdToken token;
+    MethodKind kind;
+    // Number of entries; the latency fields cover completed calls only.
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    LatencyHistogram latency;
+
+    void Record(uint64_t elapsedNs);
+
+    // Hash of the signature blob, set along with the name.
+    uint32_t signature;
+
+    // Set by the mapper when `argument_top_k` is on and some argument can be
+    // decoded.
+    std::atomic<ArgumentSketches*> arguments;
+
+    // Set by the mapper when `hardware_counters` is on.
+    std::atomic<MethodCounters*> counters;
+
+    bool HasName() const;
+    // The resolved name, or a placeholder built from the ids.
+    std::string Name() const;
+    // Publishes the name once; later calls are ignored.
+    void SetName(const std::string& name);
+
+private:
+    std::atomic<std::string*> name;
+};
+
+// Owns every MethodStats. Insertion only happens in the mapper, so a mutex is
+// fine there; the hooks write to the records without taking it.
+class MethodTable
+{
+private:
+    std::mutex mutex;
+    std::vector<MethodStats*> methods;
+    std::unordered_map<FunctionID, MethodStats*> byFunctionId;
+public:
+    ~MethodTable();
+    // Returns nullptr when the memory budget has no room for another record.
+    MethodStats* Add(FunctionID functionId, ModuleID moduleId, mdToken token, MethodKind kind);
+    MethodStats* Find(FunctionID functionId);
+    std::vector<MethodStats*> List();
+};
+
+// One place the process blocked: a wait method, the type of the object it
+// waited on, and the method that called it.
+struct WaitSite
+{
+    MethodStats* method;
+    ClassID lockClass;
+    FunctionID caller;
+    std::string callerName;
+    uint64_t waits;
+    uint64_t totalNs;
+    uint64_t maxNs;
+};
+
+// Waits that took at least the contention threshold. Only those get here,
+// after having blocked anyway, so a mutex is fine.
+class WaitTable
+{
+private:
+    std::mutex mutex;
+    std::map<std::tuple<MethodStats*, ClassID, FunctionID>, WaitSite> sites;
+public:
+    // `callerName` is only called the first time a site is seen. Returns false
+    // when the memory budget has no room for a new site.
+    bool Record(
+            MethodStats* method,
+            ClassID lockClass,
+            FunctionID caller,
+            uint64_t elapsedNs,
+            const std::function<std::string()>& callerName
+    );
+    std::vector<WaitSite> List();
+};
+
+// Totals over the runs of one test method. A run covers the method's
+// synchronous part on the thread that called it; allocations are that
+// thread's, GCs are process-wide and so shared by tests running in parallel.
+struct TestStats
+{
+    explicit TestStats(MethodStats* method);
+
+    MethodStats* method;
+    std::atomic<uint64_t> runs;
+    // Runs that ended in an exception.
+    std::atomic<uint64_t> failures;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    std::atomic<uint64_t> allocatedBytes;
+    std::atomic<uint64_t> allocatedObjects;
+    std::atomic<uint64_t> gcCount;
+    std::atomic<uint64_t> gcNs;
+};
+
+// Created on a test's first run, which is rare enough for a mutex.
+class TestTable
+{
+private:
+    std::mutex mutex;
+    std::unordered_map<MethodStats*, TestStats*> byMethod;
+    std::vector<TestStats*> tests;
+public:
+    ~TestTable();
+    // Returns nullptr when the memory budget has no room for another record.
+    TestStats* Get(MethodStats* method);
+    std::vector<TestStats*> List();
+};
+
+// JIT statistics for one dynamic method: a DynamicMethod, compiled
+// expression tree, compiled regex and the like. Those have no metadata, so
+// they are told apart by their name and a hash of their IL, which is stable
+// across runs that emit the same code.
+struct DynamicMethodStats
+{
+    // `<Dynamic>!<Dynamic>::Name#hash`, with `<Dynamic>` for both the
+    // assembly and the type, as other method names go; their MethodStats
+    // and the callers of wait sites are named the same.
+    std::string name;
+    uint32_t ilSize;
+    uint64_t compilations;
+    uint64_t failures;
+    uint64_t jitNs;
+    uint64_t maxJitNs;
+};
+
+// Filled from the DynamicMethodJITCompilation callbacks, which are not hot,
+// so a mutex is fine.
+class DynamicMethodTable
+{
+private:
+    struct Pending
+    {
+        std::string name;
+        uint32_t ilSize;
+        uint64_t startNs;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, DynamicMethodStats> methods;
+    std::unordered_map<FunctionID, Pending> pending;
+    // What the mapper names a FunctionID by. Kept after compilation, and
+    // replaced should the runtime reuse the id for another dynamic method.
+    std::unordered_map<FunctionID, std::string> names;
+
+public:
+    // The type name dynamic methods are given, and the assembly name filter
+    // patterns select them by, e.g. `<Dynamic>!*`.
+    static const char* const TypeName;
+
+    void Started(FunctionID functionId, const std::string& name, LPCBYTE il, ULONG ilSize, uint64_t now);
+    void Finished(FunctionID functionId, HRESULT status, uint64_t now);
+    // Whether `functionId` is a dynamic method, and its full synthetic name.
+    bool Find(FunctionID functionId, std::string& name);
+    std::vector<DynamicMethodStats> List();
+};
+
+// How the finalizable objects of one type fared.
+struct FinalizationStats
+{
+    ClassID classId;
+    uint64_t queued;
+    uint64_t finalized;
+    // Time from being queued to the start of Finalize, over the objects
+    // whose queue time was kept.
+    uint64_t totalWaitNs;
+    uint64_t maxWaitNs;
+};
+
+// Pairs the FinalizeableObjectQueued callbacks of each type with the calls of
+// its Finalize, oldest first. The finalizer thread drains the queue in
+// order, so this times each object without tracking ObjectIDs, which GCs
+// move. Both sides run once per finalizable object, so a mutex is fine.
+class FinalizationTable
+{
+private:
+    struct Entry
+    {
+        FinalizationStats stats;
+        std::deque<uint64_t> queuedNs;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<ClassID, Entry> types;
+
+public:
+    // Queue times kept per type; past this many the oldest are dropped, and
+    // the objects left to pair with them are timed short.
+    static const size_t MaxPending = 1024;
+
+    void Queued(ClassID classId, uint64_t now);
+    void Finalized(ClassID classId, uint64_t now);
+    std::vector<FinalizationStats> List();
+};
+
+// GC handles created and destroyed per type of the object they were created
+// for, from the handle callbacks.
+struct HandleStats
+{
+    HandleStats();
+
+    // The key of handles created without an object; no ClassID is 1.
+    static const uintptr_t NoClass = 1;
+
+    // The key each live handle was counted under.
+    HandleTable live;
+    CounterTable created;
+    CounterTable destroyed;
+    // Destroyed handles that were not in `live`: created before the
+    // profiler attached, or while `live` was full.
+    std::atomic<uint64_t> untracked;
+
+    void Created(GCHandleID handleId, ClassID classId);
+    void Destroyed(GCHandleID handleId);
+};
+
+enum class LoadKind : uint8_t
+{
+    Assembly,
+    Class,
+    // A class with type arguments.
+    Generic,
+};
+
+// What loading one assembly or class cost before startup ended, over all the
+// times it was loaded, e.g. once per AssemblyLoadContext.
+struct LoadStats
+{
+    LoadKind kind;
+    std::string name;
+    uint64_t count;
+    uint64_t failures;
+    // With and without the loads nested in it.
+    uint64_t totalNs;
+    uint64_t selfNs;
+    // When it was first loaded, since the profiler started.
+    uint64_t firstNs;
+};
+
+// Class and assembly loads from the start of the process until the first
+// call of a `startup` method, by name. Loads are rare next to calls, so a
+// mutex is fine.
+class StartupTable
+{
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, LoadStats> loads;
+    std::atomic<bool> running;
+    MethodStats* endedBy;
+    uint64_t endNs;
+    // Time in outermost loads, on all threads and on the one that ended
+    // startup.
+    uint64_t loadNs;
+    uint64_t criticalLoadNs;
+
+public:
+    StartupTable();
+
+    bool Running() const;
+    // `sinceStartNs` is when the load started, since the profiler started.
+    void Record(
+            LoadKind kind,
+            const std::string& name,
+            bool failed,
+            bool outermost,
+            uint64_t totalNs,
+            uint64_t selfNs,
+            uint64_t sinceStartNs
+    );
+    // Ends startup in a call of `method`, on a thread that had spent
+    // `threadLoadNs` loading. Only the first call counts.
+    void End(MethodStats* method, uint64_t sinceStartNs, uint64_t threadLoadNs);
+    // Returns false while startup runs.
+    bool Ended(MethodStats*& method, uint64_t& sinceStartNs, uint64_t& criticalLoadNs);
+    uint64_t LoadNs();
+    std::vector<LoadStats> List();
+};
+
+struct GcStats
+{
+    static const int MaxGenerations = 3;
+
+    GcStats();
+
+    std::atomic<uint64_t> collections[MaxGenerations];
+    std::atomic<uint64_t> induced;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    uint64_t startNs;
+
+    void Started(int cGenerations, BOOL generationCollected[], COR_PRF_GC_REASON reason, uint64_t now);
+    void Finished(uint64_t now);
+};
+
+// Exact counts of what was given up to stay within the memory budget.
+struct DropStats
+{
+    DropStats();
+
+    // Enter events traced with a timestamp but without their arguments.
+    std::atomic<uint64_t> arguments;
+    // Enter and leave events that were only counted, not traced.
+    std::atomic<uint64_t> events;
+    // Methods left unhooked because their stats could not be allocated.
+    std::atomic<uint64_t> methods;
+};
+
+struct Profile
+{
+    Profile();
+
+    uint64_t startNs;
+    // Tells this process apart from others with the same pid, such as a
+    // later process reusing it or the pid 1 of every container: the wall
+    // clock start time in nanoseconds and a random nonce, in hex.
+    std::string instance;
+    MethodTable methods;
+    WaitTable waits;
+    TestTable tests;
+    GcStats gc;
+    DynamicMethodTable dynamicMethods;
+    // Exceptions thrown, counted when a trigger watches their rate.
+    std::atomic<uint64_t> exceptions;
+    // Filled when `object_lifetimes` is set.
+    FinalizationTable finalization;
+    HandleStats handles;
+    // Filled when `startup` is set.
+    StartupTable startup;
+    // Objects allocated per ClassID, as reported by ObjectsAllocatedByClass.
+    CounterTable allocations;
+    // Bytes allocated per ClassID, from ObjectAllocated, which only `tests`
+    // turns on; ObjectsAllocatedByClass has no sizes.
+    CounterTable allocatedBytes;
+    // Per FunctionID, from the code transition callbacks: P/Invokes and the
+    // time spent in native code, and managed methods called back from native
+    // code and the time spent in them.
+    CounterTable pinvokeCalls;
+    CounterTable pinvokeNs;
+    CounterTable reverseCalls;
+    CounterTable reverseNs;
+    DropStats drops;
+
+    std::mutex classNamesMutex;
+    std::unordered_map<ClassID, std::string> classNames;
+    std::mutex functionNamesMutex;
+    std::unordered_map<FunctionID, std::string> functionNames;
+};
+
+// Renders the current aggregates as tab-separated `key=value` records, one
+// per line, for the report socket. Methods never entered are left out; the
+// others are printed under whatever name the Symbolizer has resolved so far.
+// Wait sites, dynamic methods, tests, finalizable types and startup loads
+// come slowest first. A last `end` record tells a complete profile from one
+// cut off in transit.
+std::string FormatProfile(ICorProfilerInfo2& info, Profile& profile);
+
+// Names a LoadKind in the profile output.
+const char* LoadKindName(LoadKind kind);
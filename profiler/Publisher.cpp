@@ -0,0 +1,98 @@
+#include "Publisher.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// An aggregator that stops reading must not wedge the publisher thread, or
+// shutdown with it.
+static const int SendTimeoutSeconds = 5;
+
+Publisher::Publisher(const std::string& socketPath, int intervalSeconds, std::function<std::string()> snapshot) :
+    socketPath(socketPath),
+    intervalSeconds(intervalSeconds),
+    snapshot(snapshot),
+    stopping(false)
+{
+}
+
+Publisher::~Publisher()
+{
+    this->Stop();
+}
+
+void Publisher::Start() {
+    this->thread = std::thread(&Publisher::Run, this);
+}
+
+void Publisher::Stop() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    this->thread.join();
+    this->Publish();
+}
+
+void Publisher::Run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->stopping) {
+        this->wake.wait_for(lock, std::chrono::seconds(this->intervalSeconds));
+        if (this->stopping) {
+            break;
+        }
+        lock.unlock();
+        this->Publish();
+        lock.lock();
+    }
+}
+
+bool Publisher::Publish() {
+    struct sockaddr_un address;
+    if (this->socketPath.size() >= sizeof(address.sun_path)) {
+        printf("Error: aggregator socket path too long: %s\n", this->socketPath.c_str());
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, this->socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("Error: socket %s\n", strerror(errno));
+        return false;
+    }
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        // Not running yet, or restarting; the next interval tries again.
+        close(fd);
+        return false;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = SendTimeoutSeconds;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string data = this->snapshot();
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return false;
+        }
+        offset += (size_t) written;
+    }
+    close(fd);
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Background thread pushing snapshots of the live aggregates to a
+// ProfileAggregator listening on a Unix domain socket: every interval, and
+// once more on Stop(). Each snapshot goes over a connection of its own,
+// which is closed once it is written, so the aggregator reads until EOF.
+// An aggregator that is not running only costs a failed connect.
+class Publisher
+{
+private:
+    std::string socketPath;
+    int intervalSeconds;
+    std::function<std::string()> snapshot;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread thread;
+
+    void Run();
+    bool Publish();
+
+public:
+    Publisher(const std::string& socketPath, int intervalSeconds, std::function<std::string()> snapshot);
+    ~Publisher();
+    void Start();
+    // Publishes a last snapshot, so the aggregator sees the final totals.
+    void Stop();
+};
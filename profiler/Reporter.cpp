@@ -0,0 +1,109 @@
+#include "Reporter.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// How long accept() waits before checking whether Stop() was called.
+static const int PollTimeoutMs = 200;
+
+// A scraper that stops reading must not wedge the reporter thread.
+static const int SendTimeoutSeconds = 1;
+
+Reporter::Reporter(const std::string& socketPath, std::function<std::string()> snapshot) :
+    socketPath(socketPath),
+    snapshot(snapshot),
+    listenFd(-1),
+    stopping(false)
+{
+}
+
+Reporter::~Reporter()
+{
+    this->Stop();
+}
+
+bool Reporter::Start() {
+    struct sockaddr_un address;
+    if (this->socketPath.size() >= sizeof(address.sun_path)) {
+        printf("Error: report socket path too long: %s\n", this->socketPath.c_str());
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, this->socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->listenFd < 0) {
+        printf("Error: socket %s\n", strerror(errno));
+        return false;
+    }
+
+    // A previous process may have left its socket file behind.
+    unlink(this->socketPath.c_str());
+    if (
+            bind(this->listenFd, (struct sockaddr *) &address, sizeof(address)) != 0
+            || listen(this->listenFd, 8) != 0
+    ) {
+        printf("Error: bind %s: %s\n", this->socketPath.c_str(), strerror(errno));
+        close(this->listenFd);
+        this->listenFd = -1;
+        return false;
+    }
+
+    this->thread = std::thread(&Reporter::Run, this);
+    return true;
+}
+
+void Reporter::Stop() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+    this->stopping.store(true);
+    this->thread.join();
+    close(this->listenFd);
+    this->listenFd = -1;
+    unlink(this->socketPath.c_str());
+}
+
+void Reporter::Run() {
+    while (!this->stopping.load()) {
+        struct pollfd pending;
+        pending.fd = this->listenFd;
+        pending.events = POLLIN;
+        pending.revents = 0;
+        if (poll(&pending, 1, PollTimeoutMs) <= 0) {
+            continue;
+        }
+
+        int clientFd = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (clientFd < 0) {
+            continue;
+        }
+        struct timeval timeout;
+        timeout.tv_sec = SendTimeoutSeconds;
+        timeout.tv_usec = 0;
+        setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        this->Serve(clientFd);
+        close(clientFd);
+    }
+}
+
+void Reporter::Serve(int clientFd) {
+    std::string data = this->snapshot();
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = send(clientFd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        offset += (size_t) written;
+    }
+}
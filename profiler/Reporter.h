@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Background thread serving snapshots of the live aggregates over a Unix
+// domain socket. Every connection gets one snapshot and is then closed, so a
+// scraper only has to connect and read until EOF.
+class Reporter
+{
+private:
+    std::string socketPath;
+    std::function<std::string()> snapshot;
+    int listenFd;
+    std::atomic<bool> stopping;
+    std::thread thread;
+
+    void Run();
+    void Serve(int clientFd);
+
+public:
+    Reporter(const std::string& socketPath, std::function<std::string()> snapshot);
+    ~Reporter();
+    bool Start();
+    void Stop();
+};
@@ -0,0 +1,151 @@
+#include "Symbolizer.h"
+#include "CComPtr.h"
+#include "Metadata.h"
+#include "ModuleTable.h"
+#include "Overhead.h"
+#include "Profile.h"
+#include "profiler_pal.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+// How often the background thread names newly entered methods.
+static const int ResolveIntervalMs = 1000;
+
+Symbolizer::Symbolizer(ICorProfilerInfo3& info, ModuleTable& modules, MethodTable& methods) :
+    info(info),
+    modules(modules),
+    methods(methods),
+    stopping(false)
+{
+}
+
+Symbolizer::~Symbolizer()
+{
+    this->Stop();
+}
+
+void Symbolizer::Resolve(const std::vector<MethodStats*>& batch) {
+    std::vector<MethodStats*> pending;
+    for (MethodStats* method : batch) {
+        if (!method->HasName()) {
+            pending.push_back(method);
+        }
+    }
+    if (pending.empty()) {
+        return;
+    }
+
+    std::sort(pending.begin(), pending.end(), [](const MethodStats* a, const MethodStats* b) {
+        return a->moduleId < b->moduleId;
+    });
+
+    std::lock_guard<std::mutex> lock(this->resolveMutex);
+    OverheadScope scope(OverheadMetadata);
+    size_t begin = 0;
+    while (begin < pending.size()) {
+        ModuleID moduleId = pending[begin]->moduleId;
+        size_t end = begin;
+        while (end < pending.size() && pending[end]->moduleId == moduleId) {
+            end++;
+        }
+
+        std::shared_ptr<const ModuleInfo> module = this->modules.Get(this->info, moduleId);
+        if (module == nullptr) {
+            begin = end;
+            continue;
+        }
+
+        // Names of methods indexed at module load are already at hand.
+        std::vector<MethodStats*> unindexed;
+        for (size_t i = begin; i < end; i++) {
+            MethodStats* method = pending[i];
+            if (module->IsIndexed(method->token)) {
+                method->signature = module->Signature(method->token);
+                method->SetName(module->assemblyName + "!" + module->MethodName(method->token));
+            } else {
+                unindexed.push_back(method);
+            }
+        }
+        begin = end;
+        if (unindexed.empty()) {
+            continue;
+        }
+
+        CComPtr<IMetaDataImport2> metaDataImport2;
+        HRESULT result = this->info.GetModuleMetaData(
+                moduleId,
+                ofRead,
+                IID_IMetaDataImport,
+                (IUnknown **) &metaDataImport2
+        );
+        if (FAILED(result)) {
+            continue;
+        }
+
+        // Methods of the same module often share their declaring type.
+        std::unordered_map<mdTypeDef, std::string> typeNames;
+        for (MethodStats* method : unindexed) {
+            mdTypeDef classId;
+            std::string name = ToBytes(GetFunctionName(metaDataImport2, method->token, classId));
+            auto type = typeNames.find(classId);
+            if (type == typeNames.end()) {
+                type = typeNames.insert(std::make_pair(
+                        classId,
+                        ToBytes(GetFullTypeName(metaDataImport2, classId))
+                )).first;
+            }
+            method->signature = GetSignatureHash(metaDataImport2, method->token);
+            method->SetName(module->assemblyName + "!" + type->second + "::" + name);
+        }
+    }
+}
+
+void Symbolizer::ResolveEntered() {
+    std::vector<MethodStats*> entered;
+    for (MethodStats* method : this->methods.List()) {
+        if (method->calls.load(std::memory_order_relaxed) != 0 && !method->HasName()) {
+            entered.push_back(method);
+        }
+    }
+    this->Resolve(entered);
+}
+
+void Symbolizer::ResolveModule(ModuleID moduleId) {
+    std::vector<MethodStats*> inModule;
+    for (MethodStats* method : this->methods.List()) {
+        if (method->moduleId == moduleId && !method->HasName()) {
+            inModule.push_back(method);
+        }
+    }
+    this->Resolve(inModule);
+}
+
+void Symbolizer::Start() {
+    this->thread = std::thread(&Symbolizer::Run, this);
+}
+
+void Symbolizer::Stop() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->wake.notify_one();
+    }
+    this->thread.join();
+}
+
+void Symbolizer::Run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->stopping) {
+        this->wake.wait_for(lock, std::chrono::milliseconds(ResolveIntervalMs));
+        if (this->stopping) {
+            break;
+        }
+        lock.unlock();
+        this->ResolveEntered();
+        lock.lock();
+    }
+}
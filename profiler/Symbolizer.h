@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cor.h"
+#include "corprof.h"
+
+struct MethodStats;
+class MethodTable;
+class ModuleTable;
+
+// Resolves method names off the JIT path. The mapper only records
+// (FunctionID, ModuleID, mdToken); names are looked up in batches grouped by
+// module, only for methods that were actually entered, either by the
+// background thread or right before output is produced. Module unloads
+// resolve whatever is left in the module while its metadata is still valid.
+class Symbolizer
+{
+private:
+    ICorProfilerInfo3& info;
+    ModuleTable& modules;
+    MethodTable& methods;
+
+    // Serializes resolution so each name is only looked up once.
+    std::mutex resolveMutex;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread thread;
+
+    void Run();
+
+public:
+    Symbolizer(ICorProfilerInfo3& info, ModuleTable& modules, MethodTable& methods);
+    ~Symbolizer();
+
+    // Resolves every unnamed method in `batch`, opening each module's
+    // metadata once.
+    void Resolve(const std::vector<MethodStats*>& batch);
+
+    // Resolves the methods that were entered at least once.
+    void ResolveEntered();
+
+    // Resolves every method of a module that is about to unload.
+    void ResolveModule(ModuleID moduleId);
+
+    void Start();
+    void Stop();
+};
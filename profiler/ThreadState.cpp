@@ -0,0 +1,235 @@
+#include "ThreadState.h"
+#include "MemoryBudget.h"
+#include "TraceWriter.h"
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static std::mutex& RegistryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<ThreadState*>& Registry() {
+    static std::vector<ThreadState*> registry;
+    return registry;
+}
+
+ThreadState::ThreadState() :
+    osThreadId((uint64_t) syscall(SYS_gettid)),
+    depth(0),
+    transitionDepth(0),
+    loadDepth(0),
+    writer(nullptr),
+    chunk(nullptr),
+    writing(nullptr),
+    countersOpened(false)
+{
+    this->test.stats = nullptr;
+    this->loadNs = 0;
+    GetMemoryBudget().Charge(sizeof(ThreadState));
+    std::lock_guard<std::mutex> lock(RegistryMutex());
+    Registry().push_back(this);
+}
+
+ThreadState::~ThreadState()
+{
+    TraceChunk* partial = this->TakeChunk();
+    if (partial != nullptr) {
+        this->writer->Submit(partial);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(RegistryMutex());
+        // Under the registry lock, so a concurrent CollectOverhead() counts
+        // this thread exactly once.
+        RetireOverhead(this->overhead);
+        std::vector<ThreadState*>& registry = Registry();
+        registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+    }
+
+    GetMemoryBudget().Release(
+            sizeof(ThreadState)
+            + this->scratch.size()
+            + this->frameCounters.size() * sizeof(CounterSample)
+    );
+}
+
+void ThreadState::Push(MethodStats* method, uint64_t startNs, uintptr_t context) {
+    if (this->depth < MaxDepth) {
+        this->frames[this->depth].method = method;
+        this->frames[this->depth].startNs = startNs;
+        this->frames[this->depth].context = context;
+    }
+    this->depth++;
+}
+
+bool ThreadState::Pop(MethodStats* method, Frame& frame) {
+    if (this->depth > MaxDepth) {
+        // Frames past MaxDepth are counted but not recorded.
+        this->depth--;
+        return false;
+    }
+    for (int i = this->depth - 1; i >= 0; i--) {
+        if (this->frames[i].method == method) {
+            frame = this->frames[i];
+            this->depth = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+MethodStats* ThreadState::Top() const {
+    if (this->depth == 0 || this->depth > MaxDepth) {
+        return nullptr;
+    }
+    return this->frames[this->depth - 1].method;
+}
+
+int ThreadState::Depth() const {
+    return this->depth;
+}
+
+void ThreadState::PushTransition(uintptr_t functionId, bool reverse, uint64_t startNs) {
+    if (this->transitionDepth < MaxTransitions) {
+        this->transitions[this->transitionDepth].functionId = functionId;
+        this->transitions[this->transitionDepth].reverse = reverse;
+        this->transitions[this->transitionDepth].startNs = startNs;
+    }
+    this->transitionDepth++;
+}
+
+bool ThreadState::PopTransition(uintptr_t functionId, bool reverse, uint64_t& startNs) {
+    if (this->transitionDepth > MaxTransitions) {
+        this->transitionDepth--;
+        return false;
+    }
+    for (int i = this->transitionDepth - 1; i >= 0; i--) {
+        if (this->transitions[i].functionId == functionId && this->transitions[i].reverse == reverse) {
+            startNs = this->transitions[i].startNs;
+            this->transitionDepth = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadState::PushLoad(uintptr_t id, bool assembly, uint64_t startNs) {
+    if (this->loadDepth < MaxLoads) {
+        this->loads[this->loadDepth].id = id;
+        this->loads[this->loadDepth].assembly = assembly;
+        this->loads[this->loadDepth].startNs = startNs;
+        this->loads[this->loadDepth].nestedNs = 0;
+    }
+    this->loadDepth++;
+}
+
+bool ThreadState::PopLoad(uintptr_t id, bool assembly, uint64_t now, uint64_t& totalNs, uint64_t& selfNs) {
+    if (this->loadDepth > MaxLoads) {
+        this->loadDepth--;
+        return false;
+    }
+    for (int i = this->loadDepth - 1; i >= 0; i--) {
+        if (this->loads[i].id == id && this->loads[i].assembly == assembly) {
+            totalNs = now - this->loads[i].startNs;
+            selfNs = totalNs > this->loads[i].nestedNs ? totalNs - this->loads[i].nestedNs : 0;
+            this->loadDepth = i;
+            if (i > 0) {
+                this->loads[i - 1].nestedNs += totalNs;
+            } else {
+                this->loadNs += totalNs;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+int ThreadState::LoadDepth() const {
+    return this->loadDepth;
+}
+
+bool ThreadState::ReadCounters(CounterSample& sample) {
+    if (!this->countersOpened) {
+        this->countersOpened = true;
+        if (!this->counters.Open(this->osThreadId)) {
+            // Once is enough: other threads fail the same way.
+            static std::atomic<bool> reported(false);
+            if (!reported.exchange(true)) {
+                printf("Error: perf_event_open failed for thread %lu\n", (unsigned long) this->osThreadId);
+            }
+        }
+    }
+    sample.valid = this->counters.Read(sample);
+    return sample.valid;
+}
+
+CounterSample* ThreadState::FrameCounters(int index) {
+    if (index < 0 || index >= MaxDepth) {
+        return nullptr;
+    }
+    if (this->frameCounters.empty()) {
+        if (!GetMemoryBudget().TryReserve(MaxDepth * sizeof(CounterSample))) {
+            return nullptr;
+        }
+        this->frameCounters.resize(MaxDepth);
+    }
+    return &this->frameCounters[index];
+}
+
+uint8_t* ThreadState::BeginRecord(TraceWriter& writer, size_t size) {
+    this->writer = &writer;
+    this->writing = this->chunk.exchange(nullptr, std::memory_order_acquire);
+
+    if (size > TraceChunk::Capacity) {
+        this->chunk.store(this->writing, std::memory_order_release);
+        return nullptr;
+    }
+    if (this->writing != nullptr && this->writing->used + size > TraceChunk::Capacity) {
+        writer.Submit(this->writing);
+        this->writing = nullptr;
+    }
+    if (this->writing == nullptr) {
+        this->writing = writer.Acquire();
+        if (this->writing == nullptr) {
+            return nullptr;
+        }
+        this->writing->threadId = this->osThreadId;
+    }
+    return this->writing->data + this->writing->used;
+}
+
+void ThreadState::EndRecord(size_t size) {
+    this->writing->used += size;
+    this->chunk.store(this->writing, std::memory_order_release);
+    this->writing = nullptr;
+}
+
+TraceChunk* ThreadState::TakeChunk() {
+    return this->chunk.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+uint8_t* ThreadState::Scratch(size_t size) {
+    if (size > this->scratch.size()) {
+        if (!GetMemoryBudget().TryReserve(size - this->scratch.size())) {
+            return nullptr;
+        }
+        this->scratch.resize(size);
+    }
+    return this->scratch.data();
+}
+
+ThreadState& GetThreadState() {
+    static thread_local ThreadState state;
+    return state;
+}
+
+void ForEachThreadState(std::function<void(ThreadState&)> visit) {
+    std::lock_guard<std::mutex> lock(RegistryMutex());
+    for (ThreadState* state : Registry()) {
+        visit(*state);
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "HardwareCounters.h"
+#include "Overhead.h"
+
+struct MethodStats;
+struct TestStats;
+struct TraceChunk;
+class TraceWriter;
+
+struct Frame
+{
+    MethodStats* method;
+    uint64_t startNs;
+    // Captured at Enter for the method's kind: for waits, the ClassID of
+    // the object waited on.
+    uintptr_t context;
+};
+
+struct Transition
+{
+    uintptr_t functionId;
+    bool reverse;
+    uint64_t startNs;
+};
+
+// A class or assembly load in progress.
+struct Load
+{
+    uintptr_t id;
+    bool assembly;
+    uint64_t startNs;
+    // Time spent in the loads it triggered.
+    uint64_t nestedNs;
+};
+
+// The outermost test running on a thread: where it started, and the
+// allocations counted since.
+struct TestRun
+{
+    TestStats* stats;
+    // Shadow stack depth with the test's frame pushed.
+    int depth;
+    uint64_t startNs;
+    uint64_t gcCount;
+    uint64_t gcNs;
+    uint64_t allocatedBytes;
+    uint64_t allocatedObjects;
+};
+
+// Per-thread hook state: the shadow stack of hooked frames used to pair
+// Enter with Leave/Tailcall, the stack of managed/native transitions, and the
+// trace chunk the thread is filling. Only
+// touched by its own thread, except for TakeChunk().
+class ThreadState
+{
+public:
+    static const int MaxDepth = 256;
+    static const int MaxTransitions = 64;
+    static const int MaxLoads = 32;
+
+    ThreadState();
+    ~ThreadState();
+
+    uint64_t osThreadId;
+
+    // Time this thread spent in profiler code; see OverheadScope.
+    OverheadCounters overhead;
+
+    // Valid while `test.stats` is set.
+    TestRun test;
+
+    // Time this thread spent in its outermost class and assembly loads.
+    uint64_t loadNs;
+
+    void Push(MethodStats* method, uint64_t startNs, uintptr_t context = 0);
+
+    // Pops up to and including the topmost frame for `method`. Frames above
+    // it are ones an exception unwound without a Leave callback.
+    bool Pop(MethodStats* method, Frame& frame);
+
+    // The method of the topmost recorded frame, or nullptr.
+    MethodStats* Top() const;
+    // Number of frames pushed and not popped, recorded or not.
+    int Depth() const;
+
+    // Same as Push/Pop, for P/Invokes (native code called from managed code)
+    // and reverse P/Invokes (managed code called from native code).
+    void PushTransition(uintptr_t functionId, bool reverse, uint64_t startNs);
+    bool PopTransition(uintptr_t functionId, bool reverse, uint64_t& startNs);
+
+    // Same again for class and assembly loads, which nest as loading a type
+    // loads its base types and the assemblies they come from. PopLoad gives
+    // the load's time with and without the loads nested in it.
+    void PushLoad(uintptr_t id, bool assembly, uint64_t startNs);
+    bool PopLoad(uintptr_t id, bool assembly, uint64_t now, uint64_t& totalNs, uint64_t& selfNs);
+    int LoadDepth() const;
+
+    // Returns room for a `size`-byte record in this thread's chunk, handing
+    // the chunk to `writer` when full. Returns nullptr, leaving nothing to
+    // commit, when no chunk is available; otherwise EndRecord must follow.
+    uint8_t* BeginRecord(TraceWriter& writer, size_t size);
+    void EndRecord(size_t size);
+
+    // Detaches the partially filled chunk, for flushing from another thread.
+    TraceChunk* TakeChunk();
+
+    // Reads this thread's hardware counters, opening them on first use.
+    // Returns false when they cannot be opened.
+    bool ReadCounters(CounterSample& sample);
+    // Where the counters read when the frame at `index` was pushed are
+    // kept, or nullptr past MaxDepth or the memory budget.
+    CounterSample* FrameCounters(int index);
+
+    // Reusable buffer for GetFunctionEnter3Info, grown within the memory
+    // budget. Returns nullptr when the budget refuses to grow it.
+    uint8_t* Scratch(size_t size);
+    size_t ScratchSize() const
+    {
+        return this->scratch.size();
+    }
+
+private:
+    Frame frames[MaxDepth];
+    int depth;
+
+    Transition transitions[MaxTransitions];
+    int transitionDepth;
+
+    Load loads[MaxLoads];
+    int loadDepth;
+
+    TraceWriter* writer;
+    std::atomic<TraceChunk*> chunk;
+    TraceChunk* writing;
+
+    std::vector<uint8_t> scratch;
+
+    ThreadCounters counters;
+    bool countersOpened;
+    std::vector<CounterSample> frameCounters;
+};
+
+ThreadState& GetThreadState();
+
+void ForEachThreadState(std::function<void(ThreadState&)> visit);
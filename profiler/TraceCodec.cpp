@@ -0,0 +1,207 @@
+#include "TraceCodec.h"
+#include "Lz.h"
+#include "TraceFormat.h"
+#include <cstring>
+#include <unordered_map>
+
+static void WriteVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t) value);
+}
+
+static uint64_t ZigZag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t UnZigZag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+class VarintReader
+{
+private:
+    const uint8_t* cursor;
+    const uint8_t* end;
+public:
+    bool failed;
+
+    VarintReader(const uint8_t* data, size_t size) : cursor(data), end(data + size), failed(false)
+    {
+    }
+
+    uint64_t Read() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (this->cursor >= this->end) {
+                break;
+            }
+            uint8_t byte = *this->cursor++;
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        this->failed = true;
+        return 0;
+    }
+
+    const uint8_t* Take(size_t size) {
+        if ((size_t) (this->end - this->cursor) < size) {
+            this->failed = true;
+            return nullptr;
+        }
+        const uint8_t* data = this->cursor;
+        this->cursor += size;
+        return data;
+    }
+};
+
+// Walks the records of a chunk, returning false on a truncated record.
+template <typename Visitor>
+static bool ForEachRecord(const uint8_t* records, size_t size, Visitor visit) {
+    size_t offset = 0;
+    while (offset < size) {
+        if (size - offset < sizeof(RecordHeader)) {
+            return false;
+        }
+        const RecordHeader* header = (const RecordHeader*) (records + offset);
+        if (header->size < sizeof(RecordHeader) || header->size > size - offset) {
+            return false;
+        }
+        visit(header);
+        offset += header->size;
+    }
+    return true;
+}
+
+bool EncodeChunk(const uint8_t* records, size_t size, uint64_t threadId, std::vector<uint8_t>& out) {
+    std::unordered_map<uint64_t, uint64_t> dictionary;
+    std::vector<uint64_t> functionIds;
+    uint64_t recordCount = 0;
+    bool valid = ForEachRecord(records, size, [&](const RecordHeader* header) {
+        if (dictionary.insert(std::make_pair(header->functionId, (uint64_t) functionIds.size())).second) {
+            functionIds.push_back(header->functionId);
+        }
+        recordCount++;
+    });
+    if (!valid) {
+        return false;
+    }
+
+    std::vector<uint8_t> encoded;
+    encoded.reserve(size / 2);
+    WriteVarint(encoded, functionIds.size());
+    for (uint64_t functionId : functionIds) {
+        WriteVarint(encoded, functionId);
+    }
+    WriteVarint(encoded, recordCount);
+
+    uint64_t previousTimestamp = 0;
+    uint64_t previousAddress = 0;
+    ForEachRecord(records, size, [&](const RecordHeader* header) {
+        WriteVarint(encoded, header->kind);
+        WriteVarint(encoded, dictionary[header->functionId]);
+        WriteVarint(encoded, ZigZag((int64_t) (header->timestampNs - previousTimestamp)));
+        previousTimestamp = header->timestampNs;
+        if (header->kind != RecordEnterArguments) {
+            return;
+        }
+
+        const uint8_t* cursor = (const uint8_t*) header + sizeof(RecordHeader);
+        const ArgumentsHeader* arguments = (const ArgumentsHeader*) cursor;
+        WriteVarint(encoded, arguments->numRanges);
+        WriteVarint(encoded, arguments->totalArgumentSize);
+        cursor += sizeof(ArgumentsHeader);
+        for (uint32_t i = 0; i < arguments->numRanges; i++) {
+            const RangeHeader* range = (const RangeHeader*) cursor;
+            WriteVarint(encoded, ZigZag((int64_t) (range->startAddress - previousAddress)));
+            previousAddress = range->startAddress;
+            WriteVarint(encoded, range->length);
+            const uint8_t* data = cursor + sizeof(RangeHeader);
+            encoded.insert(encoded.end(), data, data + range->length);
+            cursor = data + AlignRecord(range->length);
+        }
+    });
+
+    CompressedChunkHeader header;
+    header.magic = CompressedChunkMagic;
+    header.rawSize = (uint32_t) size;
+    header.encodedSize = (uint32_t) encoded.size();
+    header.threadId = threadId;
+
+    size_t start = out.size();
+    out.resize(start + sizeof(header) + LzCompressBound(encoded.size()));
+    header.compressedSize = (uint32_t) LzCompress(encoded.data(), encoded.size(), out.data() + start + sizeof(header));
+    memcpy(out.data() + start, &header, sizeof(header));
+    out.resize(start + sizeof(header) + header.compressedSize);
+    return true;
+}
+
+bool DecodeChunk(const CompressedChunkHeader& header, const uint8_t* block, std::vector<uint8_t>& records) {
+    std::vector<uint8_t> encoded(header.encodedSize);
+    if (!LzDecompress(block, header.compressedSize, encoded.data(), encoded.size())) {
+        return false;
+    }
+
+    VarintReader reader(encoded.data(), encoded.size());
+    uint64_t dictionarySize = reader.Read();
+    if (dictionarySize > encoded.size()) {
+        return false;
+    }
+    std::vector<uint64_t> functionIds(dictionarySize);
+    for (size_t i = 0; i < functionIds.size() && !reader.failed; i++) {
+        functionIds[i] = reader.Read();
+    }
+    uint64_t recordCount = reader.Read();
+
+    records.clear();
+    records.reserve(header.rawSize);
+    uint64_t timestamp = 0;
+    uint64_t address = 0;
+    for (uint64_t i = 0; i < recordCount && !reader.failed; i++) {
+        size_t start = records.size();
+        records.resize(start + sizeof(RecordHeader));
+
+        RecordHeader record;
+        record.kind = (uint32_t) reader.Read();
+        uint64_t index = reader.Read();
+        if (index >= functionIds.size()) {
+            return false;
+        }
+        record.functionId = functionIds[index];
+        timestamp += (uint64_t) UnZigZag(reader.Read());
+        record.timestampNs = timestamp;
+
+        if (record.kind == RecordEnterArguments) {
+            ArgumentsHeader arguments;
+            arguments.numRanges = (uint32_t) reader.Read();
+            arguments.totalArgumentSize = (uint32_t) reader.Read();
+            const uint8_t* bytes = (const uint8_t*) &arguments;
+            records.insert(records.end(), bytes, bytes + sizeof(arguments));
+
+            for (uint32_t r = 0; r < arguments.numRanges && !reader.failed; r++) {
+                RangeHeader range;
+                address += (uint64_t) UnZigZag(reader.Read());
+                range.startAddress = address;
+                range.length = (uint32_t) reader.Read();
+                range.reserved = 0;
+                const uint8_t* data = reader.Take(range.length);
+                if (data == nullptr) {
+                    return false;
+                }
+                bytes = (const uint8_t*) &range;
+                records.insert(records.end(), bytes, bytes + sizeof(range));
+                records.insert(records.end(), data, data + range.length);
+                records.resize(records.size() + AlignRecord(range.length) - range.length, 0);
+            }
+        }
+
+        record.size = (uint32_t) (records.size() - start);
+        memcpy(records.data() + start, &record, sizeof(record));
+    }
+
+    return !reader.failed && records.size() == header.rawSize;
+}
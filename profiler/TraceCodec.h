@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compression of one chunk of trace records into a self-contained block:
+//
+//  1. timestamps and argument range addresses become zigzag deltas from the
+//     previous record,
+//  2. function ids are replaced by indexes into a dictionary stored at the
+//     start of the block,
+//  3. the resulting varint stream is LZ-compressed.
+//
+// Every block carries its own dictionary and delta base, so any chunk of a
+// trace can be decoded without the ones before it.
+
+// Appends a CompressedChunkHeader and the compressed block to `out`. Returns
+// false when the records are malformed.
+bool EncodeChunk(const uint8_t* records, size_t size, uint64_t threadId, std::vector<uint8_t>& out);
+
+// Decodes the block that follows `header` back into the original records.
+struct CompressedChunkHeader;
+bool DecodeChunk(const CompressedChunkHeader& header, const uint8_t* block, std::vector<uint8_t>& records);
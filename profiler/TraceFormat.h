@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Layout of the events written by the ELT hooks. Records are packed back to
+// back inside per-thread chunks and are always a multiple of 8 bytes long.
+//
+// A binary trace file is a FileHeader followed by chunks, each a ChunkHeader
+// followed by `size` bytes of records, or a CompressedChunkHeader followed by
+// `compressedSize` bytes that TraceCodec decodes back to the same records.
+// A cleanly closed file ends with a symbol chunk naming the function ids it
+// references, an index chunk locating every data chunk, and a FileFooter.
+//
+// A trace written to a file is memory-mapped and its header keeps
+// `committedSize` current after every chunk, so when the process dies the
+// file is valid up to there, and the header tells which signal killed it.
+
+enum RecordKind : uint32_t
+{
+    RecordEnter = 1,
+    RecordLeave = 2,
+    // RecordHeader, ArgumentsHeader, then `numRanges` RangeHeaders each
+    // followed by its bytes padded to 8.
+    RecordEnterArguments = 3,
+};
+
+struct RecordHeader
+{
+    uint32_t kind;
+    uint32_t size;
+    uint64_t functionId;
+    uint64_t timestampNs;
+};
+
+struct ArgumentsHeader
+{
+    uint32_t numRanges;
+    uint32_t totalArgumentSize;
+};
+
+struct RangeHeader
+{
+    uint64_t startAddress;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+static const char TraceFileMagic[8] = { 'D', 'T', 'P', 'T', 'R', 'A', 'C', 'E' };
+static const uint32_t TraceFileVersion = 2;
+static const uint32_t ChunkMagic = 0x4b4e4843; // "CHNK"
+
+enum TraceState : uint32_t
+{
+    // Being written, or the writer died without a chance to say so.
+    TraceOpen = 0,
+    TraceClosed = 1,
+    // Sealed by the fatal signal handler; see FileHeader::signal.
+    TraceCrashed = 2,
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t state;
+    // Bytes from the start of the file up to the end of the last complete
+    // chunk. 0 when the trace was streamed, e.g. to stdout; read it to the
+    // end then.
+    uint64_t committedSize;
+    uint32_t signal;
+    uint32_t reserved;
+};
+
+struct ChunkHeader
+{
+    uint32_t magic;
+    uint32_t size;
+    uint64_t threadId;
+};
+
+static const uint32_t CompressedChunkMagic = 0x4b484343; // "CCHK"
+
+struct CompressedChunkHeader
+{
+    uint32_t magic;
+    uint32_t compressedSize;
+    // Size of the records once decoded.
+    uint32_t rawSize;
+    // Size of the delta/dictionary encoding before LZ compression.
+    uint32_t encodedSize;
+    uint64_t threadId;
+};
+
+static const uint32_t SymbolChunkMagic = 0x424d5953; // "SYMB"
+
+// Followed by `count` SymbolRecords, each followed by its name padded to 8.
+struct SymbolChunkHeader
+{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t size;
+};
+
+struct SymbolRecord
+{
+    uint64_t functionId;
+    uint64_t moduleId;
+    uint32_t token;
+    uint32_t nameLength;
+};
+
+static const uint32_t IndexChunkMagic = 0x58444e49; // "INDX"
+
+// Followed by `count` IndexEntries, one per data chunk in file order.
+struct IndexChunkHeader
+{
+    uint32_t magic;
+    uint32_t count;
+};
+
+struct IndexEntry
+{
+    uint64_t offset;
+    uint64_t threadId;
+};
+
+static const char TraceFooterMagic[8] = { 'D', 'T', 'P', 'T', 'R', 'E', 'N', 'D' };
+
+// Last bytes of a cleanly closed file.
+struct FileFooter
+{
+    uint64_t symbolsOffset;
+    uint64_t indexOffset;
+    char magic[8];
+};
+
+struct TraceSymbol
+{
+    uint64_t functionId;
+    uint64_t moduleId;
+    uint32_t token;
+    std::string name;
+};
+
+inline uint32_t AlignRecord(uint32_t size) {
+    return (size + 7u) & ~7u;
+}
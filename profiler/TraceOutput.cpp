@@ -0,0 +1,227 @@
+#include "TraceOutput.h"
+#include "Overhead.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+TraceOutput* TraceOutput::Open(const std::string& path) {
+    if (path.empty()) {
+        return new StreamTraceOutput(stdout);
+    }
+    MappedTraceOutput* output = new MappedTraceOutput();
+    if (!output->Open(path)) {
+        delete output;
+        return nullptr;
+    }
+    InstallCrashSeal(output);
+    return output;
+}
+
+StreamTraceOutput::StreamTraceOutput(FILE* file) : file(file), offset(0)
+{
+}
+
+void StreamTraceOutput::Write(const void* data, size_t size) {
+    size_t written = fwrite(data, 1, size, this->file);
+    this->offset += written;
+    AddTraceBytes(written);
+}
+
+void StreamTraceOutput::Commit() {
+}
+
+uint64_t StreamTraceOutput::Offset() const {
+    return this->offset;
+}
+
+void StreamTraceOutput::Close() {
+    fflush(this->file);
+    if (this->file != stdout) {
+        fclose(this->file);
+    }
+    this->file = nullptr;
+}
+
+MappedTraceOutput::MappedTraceOutput() :
+    fd(-1),
+    first(nullptr),
+    current(nullptr),
+    currentBase(0),
+    offset(0),
+    committed(0)
+{
+}
+
+MappedTraceOutput::~MappedTraceOutput()
+{
+    this->Close();
+}
+
+bool MappedTraceOutput::MapSegment(uint64_t base) {
+    // Reserve the blocks up front: a store into a hole the file system
+    // cannot fill raises SIGBUS on whichever thread made it.
+    int result = posix_fallocate(this->fd, (off_t) base, (off_t) SegmentSize);
+    if (result != 0) {
+        printf("Error: posix_fallocate trace: %s\n", strerror(result));
+        return false;
+    }
+    void* segment = mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, (off_t) base);
+    if (segment == MAP_FAILED) {
+        printf("Error: mmap trace: %s\n", strerror(errno));
+        return false;
+    }
+    if (this->current != nullptr && this->current != this->first) {
+        munmap(this->current, SegmentSize);
+    }
+    this->current = (uint8_t*) segment;
+    this->currentBase = base;
+    return true;
+}
+
+bool MappedTraceOutput::Open(const std::string& path) {
+    this->fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (this->fd < 0) {
+        printf("Error: open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!this->MapSegment(0)) {
+        return false;
+    }
+    this->first = this->current;
+    this->offset = 0;
+    return true;
+}
+
+void MappedTraceOutput::Write(const void* data, size_t size) {
+    if (this->current == nullptr) {
+        return;
+    }
+    const uint8_t* bytes = (const uint8_t*) data;
+    AddTraceBytes(size);
+    while (size > 0) {
+        if (this->offset == this->currentBase + SegmentSize && !this->MapSegment(this->offset)) {
+            // Out of disk or address space: keep what was committed and
+            // ignore the rest.
+            if (this->current != this->first) {
+                munmap(this->current, SegmentSize);
+            }
+            this->current = nullptr;
+            return;
+        }
+        size_t room = (size_t) (this->currentBase + SegmentSize - this->offset);
+        size_t part = size < room ? size : room;
+        memcpy(this->current + (this->offset - this->currentBase), bytes, part);
+        this->offset += part;
+        bytes += part;
+        size -= part;
+    }
+}
+
+void MappedTraceOutput::Commit() {
+    if (this->current == nullptr) {
+        return;
+    }
+    FileHeader* header = this->Header();
+    // The handler reads these from the same thread or after the fact, so
+    // ordinary stores ordered by a release fence are enough.
+    std::atomic_thread_fence(std::memory_order_release);
+    header->committedSize = this->offset;
+    // A signal the runtime recovered from, such as a SIGSEGV turned into a
+    // NullReferenceException, sealed the trace on its way through; the
+    // process is still writing, so that seal no longer holds.
+    header->signal = 0;
+    header->state = TraceOpen;
+    this->committed = this->offset;
+}
+
+uint64_t MappedTraceOutput::Offset() const {
+    return this->offset;
+}
+
+FileHeader* MappedTraceOutput::Header() const {
+    return (FileHeader*) this->first;
+}
+
+void MappedTraceOutput::Close() {
+    if (this->fd < 0) {
+        return;
+    }
+    InstallCrashSeal(nullptr);
+    if (this->current != nullptr) {
+        this->committed = this->offset;
+    }
+    if (this->first != nullptr) {
+        FileHeader* header = this->Header();
+        header->committedSize = this->committed;
+        header->state = TraceClosed;
+    }
+    if (this->current != nullptr && this->current != this->first) {
+        munmap(this->current, SegmentSize);
+    }
+    if (this->first != nullptr) {
+        munmap(this->first, SegmentSize);
+    }
+    this->first = nullptr;
+    this->current = nullptr;
+    if (ftruncate(this->fd, (off_t) this->committed) != 0) {
+        printf("Error: ftruncate trace: %s\n", strerror(errno));
+    }
+    close(this->fd);
+    this->fd = -1;
+}
+
+static const int SealedSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+static const int SealedSignalCount = sizeof(SealedSignals) / sizeof(SealedSignals[0]);
+
+static std::atomic<FileHeader*> SealTarget(nullptr);
+static struct sigaction PreviousActions[SealedSignalCount];
+
+static void SealTrace(int signal, siginfo_t* info, void* context) {
+    // Only plain stores to the mapping here: nothing else is async-signal
+    // safe. Bytes past `committedSize` belong to a chunk cut short and are
+    // left for the reader to ignore.
+    FileHeader* header = SealTarget.load(std::memory_order_acquire);
+    if (header != nullptr) {
+        header->signal = (uint32_t) signal;
+        header->state = TraceCrashed;
+    }
+
+    for (int i = 0; i < SealedSignalCount; i++) {
+        if (SealedSignals[i] != signal) {
+            continue;
+        }
+        const struct sigaction& previous = PreviousActions[i];
+        if ((previous.sa_flags & SA_SIGINFO) != 0) {
+            previous.sa_sigaction(signal, info, context);
+        } else if (previous.sa_handler == SIG_DFL) {
+            // Die the way we would have without us.
+            sigaction(signal, &previous, nullptr);
+            raise(signal);
+        } else if (previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(signal);
+        }
+        return;
+    }
+}
+
+void InstallCrashSeal(MappedTraceOutput* output) {
+    SealTarget.store(output == nullptr ? nullptr : output->Header(), std::memory_order_release);
+
+    static bool installed = false;
+    if (installed || output == nullptr) {
+        return;
+    }
+    installed = true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = SealTrace;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    for (int i = 0; i < SealedSignalCount; i++) {
+        sigaction(SealedSignals[i], &action, &PreviousActions[i]);
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "TraceFormat.h"
+
+// Where the bytes of a binary trace go. Sinks write whole chunks and then
+// Commit(); only committed bytes count as part of the trace if the process
+// dies before Close().
+class TraceOutput
+{
+public:
+    virtual ~TraceOutput() {}
+    virtual void Write(const void* data, size_t size) = 0;
+    virtual void Commit() = 0;
+    // Bytes written so far, counting the file header.
+    virtual uint64_t Offset() const = 0;
+    virtual void Close() = 0;
+
+    // Maps `path`, or streams to stdout when it is empty. Returns nullptr on
+    // error.
+    static TraceOutput* Open(const std::string& path);
+};
+
+// Plain stdio stream, for stdout. Nothing survives a crash but what stdio
+// already flushed.
+class StreamTraceOutput : public TraceOutput
+{
+private:
+    FILE* file;
+    uint64_t offset;
+
+public:
+    explicit StreamTraceOutput(FILE* file);
+    void Write(const void* data, size_t size) override;
+    void Commit() override;
+    uint64_t Offset() const override;
+    void Close() override;
+};
+
+// File written through shared mappings of fixed-size segments, so that what
+// was copied in stays in the page cache when the process dies. The header
+// lives in the first segment, which stays mapped; it carries the committed
+// size and is sealed with the signal number by a fatal signal handler.
+class MappedTraceOutput : public TraceOutput
+{
+private:
+    static const size_t SegmentSize = 16 * 1024 * 1024;
+
+    int fd;
+    // The first segment, holding the header, and the one being written.
+    uint8_t* first;
+    uint8_t* current;
+    uint64_t currentBase;
+    uint64_t offset;
+    uint64_t committed;
+
+    bool MapSegment(uint64_t base);
+
+public:
+    MappedTraceOutput();
+    ~MappedTraceOutput();
+
+    bool Open(const std::string& path);
+    void Write(const void* data, size_t size) override;
+    void Commit() override;
+    uint64_t Offset() const override;
+    void Close() override;
+
+    FileHeader* Header() const;
+};
+
+// Seals the mapped trace, if any, when the process takes SIGSEGV, SIGBUS,
+// SIGILL, SIGFPE or SIGABRT, then hands the signal to whatever handler was
+// there before: the runtime turns some of those into managed exceptions and
+// carries on, in which case the next commit clears the seal.
+void InstallCrashSeal(MappedTraceOutput* output);
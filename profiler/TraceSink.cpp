@@ -0,0 +1,306 @@
+#include "TraceSink.h"
+#include "MemoryBudget.h"
+#include "Overhead.h"
+#include "TraceCodec.h"
+#include "TraceFormat.h"
+#include "TraceOutput.h"
+#include "TraceWriter.h"
+#include <cerrno>
+#include <cstring>
+
+TraceSink* TraceSink::Create(const std::string& format, const std::string& path, int threads) {
+    bool compressed = format == "compressed";
+    bool binary = compressed || format == "binary";
+    if (!binary && format != "text") {
+        printf("Error: unknown trace format %s\n", format.c_str());
+        return nullptr;
+    }
+
+    if (binary) {
+        TraceOutput* output = TraceOutput::Open(path);
+        if (output == nullptr) {
+            return nullptr;
+        }
+        if (compressed) {
+            return new CompressedTraceSink(output, threads);
+        }
+        return new BinaryTraceSink(output);
+    }
+
+    FILE* file = stdout;
+    if (!path.empty()) {
+        file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            printf("Error: fopen %s: %s\n", path.c_str(), strerror(errno));
+            return nullptr;
+        }
+    }
+    return new TextTraceSink(file);
+}
+
+TextTraceSink::TextTraceSink(FILE* file) : file(file)
+{
+}
+
+void TextTraceSink::Write(const TraceChunk& chunk) {
+    int bytes = 0;
+    size_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= chunk.used) {
+        const uint8_t* record = chunk.data + offset;
+        const RecordHeader* header = (const RecordHeader*) record;
+        offset += header->size;
+
+        bytes += fprintf(
+                this->file,
+                "%s %lu\n  thread: %lu\n  timestamp: %lu\n",
+                header->kind == RecordLeave ? "LeaveStub" : "EnterStub",
+                (unsigned long) header->functionId,
+                (unsigned long) chunk.threadId,
+                (unsigned long) header->timestampNs
+        );
+        if (header->kind != RecordEnterArguments) {
+            continue;
+        }
+
+        const ArgumentsHeader* arguments = (const ArgumentsHeader*) (record + sizeof(RecordHeader));
+        bytes += fprintf(
+                this->file,
+                "  argumentInfo:\n    numRanges: %u\n    totalArgumentSize: %u\n    ranges:\n",
+                arguments->numRanges,
+                arguments->totalArgumentSize
+        );
+
+        const uint8_t* cursor = record + sizeof(RecordHeader) + sizeof(ArgumentsHeader);
+        for (uint32_t i = 0; i < arguments->numRanges; i++) {
+            const RangeHeader* range = (const RangeHeader*) cursor;
+            const uint8_t* data = cursor + sizeof(RangeHeader);
+            bytes += fprintf(
+                    this->file,
+                    "      startAddress: %p\n      length: %u\n",
+                    (void *) range->startAddress,
+                    range->length
+            );
+
+            bytes += fprintf(this->file, "      data:");
+            for (uint32_t index = 0; index < range->length; index++) {
+                bytes += fprintf(this->file, " %02x", data[index]);
+            }
+            bytes += fprintf(this->file, "\n");
+
+            cursor = data + AlignRecord(range->length);
+        }
+    }
+    AddTraceBytes(bytes);
+}
+
+void TextTraceSink::WriteSymbols(const std::vector<TraceSymbol>& symbols) {
+    int bytes = fprintf(this->file, "Symbols:\n");
+    for (const TraceSymbol& symbol : symbols) {
+        bytes += fprintf(this->file, "  %lu: %s\n", (unsigned long) symbol.functionId, symbol.name.c_str());
+    }
+    AddTraceBytes(bytes);
+}
+
+void TextTraceSink::Close() {
+    fflush(this->file);
+    if (this->file != stdout) {
+        fclose(this->file);
+    }
+    this->file = nullptr;
+}
+
+IndexedTraceSink::IndexedTraceSink(TraceOutput* output) : output(output), symbolsOffset(0)
+{
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TraceFileMagic, sizeof(header.magic));
+    header.version = TraceFileVersion;
+    header.state = TraceOpen;
+    this->output->Write(&header, sizeof(header));
+    this->output->Commit();
+}
+
+IndexedTraceSink::~IndexedTraceSink()
+{
+    delete this->output;
+}
+
+void IndexedTraceSink::WriteChunk(uint64_t threadId, const uint8_t* records, size_t size) {
+    IndexEntry entry;
+    entry.offset = this->output->Offset();
+    entry.threadId = threadId;
+    this->index.push_back(entry);
+
+    ChunkHeader header;
+    header.magic = ChunkMagic;
+    header.size = (uint32_t) size;
+    header.threadId = threadId;
+    this->output->Write(&header, sizeof(header));
+    this->output->Write(records, size);
+    this->output->Commit();
+}
+
+void IndexedTraceSink::WriteBlock(uint64_t threadId, const std::vector<uint8_t>& block) {
+    IndexEntry entry;
+    entry.offset = this->output->Offset();
+    entry.threadId = threadId;
+    this->index.push_back(entry);
+
+    this->output->Write(block.data(), block.size());
+    this->output->Commit();
+}
+
+void IndexedTraceSink::WriteSymbolChunk(const std::vector<TraceSymbol>& symbols) {
+    this->symbolsOffset = this->output->Offset();
+
+    SymbolChunkHeader header;
+    header.magic = SymbolChunkMagic;
+    header.count = (uint32_t) symbols.size();
+    header.size = 0;
+    for (const TraceSymbol& symbol : symbols) {
+        header.size += sizeof(SymbolRecord) + AlignRecord((uint32_t) symbol.name.size());
+    }
+    this->output->Write(&header, sizeof(header));
+
+    static const char padding[8] = { 0 };
+    for (const TraceSymbol& symbol : symbols) {
+        SymbolRecord record;
+        record.functionId = symbol.functionId;
+        record.moduleId = symbol.moduleId;
+        record.token = symbol.token;
+        record.nameLength = (uint32_t) symbol.name.size();
+        this->output->Write(&record, sizeof(record));
+        this->output->Write(symbol.name.data(), symbol.name.size());
+        this->output->Write(padding, AlignRecord(record.nameLength) - record.nameLength);
+    }
+    this->output->Commit();
+}
+
+void IndexedTraceSink::Finish() {
+    FileFooter footer;
+    footer.symbolsOffset = this->symbolsOffset;
+    footer.indexOffset = this->output->Offset();
+    memcpy(footer.magic, TraceFooterMagic, sizeof(footer.magic));
+
+    IndexChunkHeader header;
+    header.magic = IndexChunkMagic;
+    header.count = (uint32_t) this->index.size();
+    this->output->Write(&header, sizeof(header));
+    this->output->Write(this->index.data(), this->index.size() * sizeof(IndexEntry));
+    this->output->Write(&footer, sizeof(footer));
+    this->output->Commit();
+    this->output->Close();
+}
+
+BinaryTraceSink::BinaryTraceSink(TraceOutput* output) : IndexedTraceSink(output)
+{
+}
+
+void BinaryTraceSink::Write(const TraceChunk& chunk) {
+    this->WriteChunk(chunk.threadId, chunk.data, chunk.used);
+}
+
+void BinaryTraceSink::WriteSymbols(const std::vector<TraceSymbol>& symbols) {
+    this->WriteSymbolChunk(symbols);
+}
+
+void BinaryTraceSink::Close() {
+    this->Finish();
+}
+
+CompressedTraceSink::CompressedTraceSink(TraceOutput* output, int threads) :
+    IndexedTraceSink(output),
+    maxInFlight(2 * (size_t) (threads > 0 ? threads : 1)),
+    nextSequence(0),
+    nextToWrite(0),
+    inFlight(0),
+    stopping(false)
+{
+    for (size_t i = 0; i < this->maxInFlight / 2; i++) {
+        this->workers.push_back(std::thread(&CompressedTraceSink::Work, this));
+    }
+}
+
+void CompressedTraceSink::Write(const TraceChunk& chunk) {
+    Job* job = new Job;
+    job->threadId = chunk.threadId;
+    job->records.assign(chunk.data, chunk.data + chunk.used);
+    // Jobs are bounded by maxInFlight, so they are charged rather than refused.
+    GetMemoryBudget().Charge(chunk.used);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this]() {
+        return this->inFlight < this->maxInFlight;
+    });
+    job->sequence = this->nextSequence++;
+    this->inFlight++;
+    this->queue.push_back(job);
+    this->changed.notify_all();
+}
+
+void CompressedTraceSink::Work() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->changed.wait(lock, [this]() {
+            return this->stopping || !this->queue.empty();
+        });
+        if (this->queue.empty()) {
+            return;
+        }
+        Job* job = this->queue.front();
+        this->queue.pop_front();
+
+        lock.unlock();
+        bool encoded;
+        {
+            OverheadScope scope(OverheadDrain);
+            encoded = EncodeChunk(job->records.data(), job->records.size(), job->threadId, job->block);
+        }
+        if (!encoded) {
+            job->block.clear();
+        }
+        lock.lock();
+
+        this->finished[job->sequence] = job;
+        while (!this->finished.empty() && this->finished.begin()->first == this->nextToWrite) {
+            Job* ready = this->finished.begin()->second;
+            this->finished.erase(this->finished.begin());
+            if (ready->block.empty()) {
+                // Records the codec rejected are kept verbatim.
+                this->WriteChunk(ready->threadId, ready->records.data(), ready->records.size());
+            } else {
+                this->WriteBlock(ready->threadId, ready->block);
+            }
+            GetMemoryBudget().Release(ready->records.size());
+            delete ready;
+            this->nextToWrite++;
+            this->inFlight--;
+        }
+        this->changed.notify_all();
+    }
+}
+
+void CompressedTraceSink::WriteSymbols(const std::vector<TraceSymbol>& symbols) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this]() {
+        return this->inFlight == 0;
+    });
+    this->WriteSymbolChunk(symbols);
+}
+
+void CompressedTraceSink::Close() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->changed.wait(lock, [this]() {
+            return this->inFlight == 0;
+        });
+        this->stopping = true;
+        this->changed.notify_all();
+    }
+    for (std::thread& worker : this->workers) {
+        worker.join();
+    }
+    this->workers.clear();
+
+    this->Finish();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TraceFormat.h"
+
+struct TraceChunk;
+class TraceOutput;
+
+// Destination for full chunks, called from the drain thread only.
+class TraceSink
+{
+public:
+    virtual ~TraceSink() {}
+    virtual void Write(const TraceChunk& chunk) = 0;
+    // Names the function ids used by the chunks, once they are all written.
+    virtual void WriteSymbols(const std::vector<TraceSymbol>& symbols) = 0;
+    virtual void Close() = 0;
+
+    // Creates the sink for `format` ("text", "binary" or "compressed")
+    // writing to `path`, or to stdout when `path` is empty. Returns nullptr on
+    // error. `threads` is the size of the compression worker pool.
+    static TraceSink* Create(const std::string& format, const std::string& path, int threads);
+};
+
+// Human-readable dump in the same shape the hooks used to print directly.
+class TextTraceSink : public TraceSink
+{
+private:
+    FILE* file;
+public:
+    explicit TextTraceSink(FILE* file);
+    void Write(const TraceChunk& chunk) override;
+    void WriteSymbols(const std::vector<TraceSymbol>& symbols) override;
+    void Close() override;
+};
+
+// What the binary formats share: the file header, chunk framing, the index of
+// chunk offsets and the closing sequence (symbols, index, footer). Every
+// chunk is committed to the output once written.
+class IndexedTraceSink : public TraceSink
+{
+private:
+    TraceOutput* output;
+    std::vector<IndexEntry> index;
+    uint64_t symbolsOffset;
+
+protected:
+    explicit IndexedTraceSink(TraceOutput* output);
+    ~IndexedTraceSink();
+
+    void WriteChunk(uint64_t threadId, const uint8_t* records, size_t size);
+    // Writes a block that already starts with its CompressedChunkHeader.
+    void WriteBlock(uint64_t threadId, const std::vector<uint8_t>& block);
+    void WriteSymbolChunk(const std::vector<TraceSymbol>& symbols);
+    // Appends the index and footer and closes the output.
+    void Finish();
+};
+
+class BinaryTraceSink : public IndexedTraceSink
+{
+public:
+    explicit BinaryTraceSink(TraceOutput* output);
+    void Write(const TraceChunk& chunk) override;
+    void WriteSymbols(const std::vector<TraceSymbol>& symbols) override;
+    void Close() override;
+};
+
+// Binary trace whose chunks are compressed by TraceCodec on a worker pool.
+// Blocks are written in the order the drain thread handed the chunks over,
+// and Write() blocks once enough chunks are in flight, which backs pressure
+// up into the memory budget rather than queueing without bound.
+class CompressedTraceSink : public IndexedTraceSink
+{
+private:
+    struct Job
+    {
+        uint64_t sequence;
+        uint64_t threadId;
+        std::vector<uint8_t> records;
+        std::vector<uint8_t> block;
+    };
+
+    size_t maxInFlight;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Job*> queue;
+    std::map<uint64_t, Job*> finished;
+    uint64_t nextSequence;
+    uint64_t nextToWrite;
+    size_t inFlight;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    void Work();
+
+public:
+    CompressedTraceSink(TraceOutput* output, int threads);
+    void Write(const TraceChunk& chunk) override;
+    void WriteSymbols(const std::vector<TraceSymbol>& symbols) override;
+    void Close() override;
+};
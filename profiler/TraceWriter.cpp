@@ -0,0 +1,195 @@
+#include "TraceWriter.h"
+#include "Overhead.h"
+#include "ThreadState.h"
+#include "TraceFormat.h"
+#include "TraceSink.h"
+
+// Budget utilization above which the hooks stop capturing arguments, and
+// above which they stop writing trace records at all.
+static const double ArgumentsThreshold = 0.5;
+static const double TimestampsThreshold = 0.8;
+
+// How often the drain thread collects partially filled chunks when no full
+// ones arrive, which bounds what a crash can lose to about this much tracing.
+static const std::chrono::milliseconds FlushInterval(1000);
+
+Detail DetailFromName(const std::string& name) {
+    if (name == "arguments") {
+        return Detail::Arguments;
+    }
+    if (name == "timestamps") {
+        return Detail::Timestamps;
+    }
+    return Detail::Counts;
+}
+
+TraceWriter::TraceWriter(MemoryBudget& budget, TraceSink* sink, Detail maxDetail) :
+    budget(budget),
+    sink(sink),
+    maxDetail(maxDetail),
+    ceiling(maxDetail),
+    running(false),
+    stopping(false),
+    accepting(false)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+    this->Stop();
+    for (TraceChunk* chunk : this->pool) {
+        delete chunk;
+        this->budget.Release(sizeof(TraceChunk));
+    }
+    delete this->sink;
+}
+
+Detail TraceWriter::CurrentDetail() const {
+    double utilization = this->budget.Utilization();
+    Detail detail = Detail::Counts;
+    if (utilization < ArgumentsThreshold) {
+        detail = Detail::Arguments;
+    } else if (utilization < TimestampsThreshold) {
+        detail = Detail::Timestamps;
+    }
+    Detail ceiling = this->Ceiling();
+    return detail < ceiling ? detail : ceiling;
+}
+
+Detail TraceWriter::MaxDetail() const {
+    return this->maxDetail;
+}
+
+Detail TraceWriter::Ceiling() const {
+    return this->ceiling.load(std::memory_order_relaxed);
+}
+
+void TraceWriter::SetCeiling(Detail ceiling) {
+    this->ceiling.store(ceiling < this->maxDetail ? ceiling : this->maxDetail, std::memory_order_relaxed);
+}
+
+TraceChunk* TraceWriter::Acquire() {
+    if (!this->accepting.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+
+    TraceChunk* chunk = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->pool.empty()) {
+            chunk = this->pool.back();
+            this->pool.pop_back();
+        }
+    }
+    if (chunk == nullptr) {
+        if (!this->budget.TryReserve(sizeof(TraceChunk))) {
+            return nullptr;
+        }
+        chunk = new TraceChunk;
+    }
+    chunk->threadId = 0;
+    chunk->used = 0;
+    return chunk;
+}
+
+void TraceWriter::Submit(TraceChunk* chunk) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->running && !this->stopping) {
+            this->pending.push_back(chunk);
+            this->ready.notify_one();
+            return;
+        }
+    }
+    this->Recycle(chunk);
+}
+
+void TraceWriter::Recycle(TraceChunk* chunk) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->pool.size() < MaxPooledChunks) {
+            this->pool.push_back(chunk);
+            return;
+        }
+    }
+    delete chunk;
+    this->budget.Release(sizeof(TraceChunk));
+}
+
+void TraceWriter::Start() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->running = true;
+    }
+    this->thread = std::thread(&TraceWriter::Run, this);
+    this->accepting.store(true);
+}
+
+void TraceWriter::Stop(const std::vector<TraceSymbol>& symbols) {
+    if (!this->thread.joinable()) {
+        return;
+    }
+    this->accepting.store(false);
+
+    ForEachThreadState([this](ThreadState& state) {
+        TraceChunk* chunk = state.TakeChunk();
+        if (chunk != nullptr) {
+            this->Submit(chunk);
+        }
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->ready.notify_one();
+    }
+    this->thread.join();
+    OverheadScope scope(OverheadDrain);
+    this->sink->WriteSymbols(symbols);
+    this->sink->Close();
+}
+
+void TraceWriter::FlushPartial() {
+    ForEachThreadState([this](ThreadState& state) {
+        TraceChunk* chunk = state.TakeChunk();
+        if (chunk == nullptr) {
+            return;
+        }
+        if (chunk->used == 0) {
+            this->Recycle(chunk);
+        } else {
+            this->Submit(chunk);
+        }
+    });
+}
+
+void TraceWriter::Run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        bool woken = this->ready.wait_for(lock, FlushInterval, [this]() {
+            return this->stopping || !this->pending.empty();
+        });
+        if (!woken) {
+            // Submit and the registry lock both take the mutex, so it is
+            // released while the partial chunks are collected.
+            lock.unlock();
+            this->FlushPartial();
+            lock.lock();
+            continue;
+        }
+        if (this->pending.empty()) {
+            return;
+        }
+
+        TraceChunk* chunk = this->pending.front();
+        this->pending.pop_front();
+
+        lock.unlock();
+        {
+            OverheadScope scope(OverheadDrain);
+            this->sink->Write(*chunk);
+        }
+        this->Recycle(chunk);
+        lock.lock();
+    }
+}
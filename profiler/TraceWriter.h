@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MemoryBudget.h"
+#include "TraceFormat.h"
+
+class TraceSink;
+
+// How much the hooks record per event. Lower levels are cheaper and are
+// what the hooks fall back to when the drain thread cannot keep up.
+enum class Detail
+{
+    Counts = 0,
+    Timestamps = 1,
+    Arguments = 2,
+};
+
+// Maps a `trace_detail` setting to its level.
+Detail DetailFromName(const std::string& name);
+
+struct TraceChunk
+{
+    static const size_t Capacity = 64 * 1024;
+
+    uint64_t threadId;
+    size_t used;
+    uint8_t data[Capacity];
+};
+
+// Moves full per-thread chunks to a sink on a background thread. Chunks come
+// out of the memory budget, so a slow sink shows up as rising utilization,
+// which lowers CurrentDetail() until the backlog is drained. The hooks never
+// wait on the drain thread: when no chunk can be had they drop the event.
+// Partial chunks are also flushed periodically so that a crash loses at most
+// the last interval of tracing.
+class TraceWriter
+{
+private:
+    static const size_t MaxPooledChunks = 4;
+
+    MemoryBudget& budget;
+    TraceSink* sink;
+    Detail maxDetail;
+    // What the hooks may record right now, at most maxDetail; lowered while
+    // triggers are armed and raised when one fires.
+    std::atomic<Detail> ceiling;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<TraceChunk*> pending;
+    std::vector<TraceChunk*> pool;
+    bool running;
+    bool stopping;
+    std::atomic<bool> accepting;
+    std::thread thread;
+
+    void Run();
+    // Hands every thread's partially filled chunk to the sink.
+    void FlushPartial();
+    void Recycle(TraceChunk* chunk);
+
+public:
+    TraceWriter(MemoryBudget& budget, TraceSink* sink, Detail maxDetail);
+    ~TraceWriter();
+
+    Detail CurrentDetail() const;
+    Detail MaxDetail() const;
+    // The detail the hooks want, before memory pressure lowers it.
+    Detail Ceiling() const;
+    void SetCeiling(Detail ceiling);
+
+    // Returns an empty chunk, or nullptr when the budget is exhausted.
+    TraceChunk* Acquire();
+    void Submit(TraceChunk* chunk);
+
+    void Start();
+    // Collects the partial chunks of every thread, drains the queue, appends
+    // `symbols` and closes the sink. Later submissions are discarded.
+    void Stop(const std::vector<TraceSymbol>& symbols = std::vector<TraceSymbol>());
+};
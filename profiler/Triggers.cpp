@@ -0,0 +1,230 @@
+#include "Triggers.h"
+#include "Clock.h"
+#include "MethodFilter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static bool ParseNumber(const std::string& text, double& number, std::string& unit) {
+    char* end = nullptr;
+    number = strtod(text.c_str(), &end);
+    if (end == text.c_str() || number < 0) {
+        return false;
+    }
+    unit = std::string(end);
+    return true;
+}
+
+static bool ParseCondition(const std::string& item, TriggerCondition& condition) {
+    condition.text = item;
+    double number = 0;
+    std::string unit;
+
+    if (item.compare(0, 4, "p99(") == 0) {
+        size_t close = item.find(")>", 4);
+        if (close == std::string::npos || !ParseNumber(item.substr(close + 2), number, unit)) {
+            return false;
+        }
+        condition.kind = TriggerCondition::Kind::Latency;
+        condition.pattern = item.substr(4, close - 4);
+        if (unit == "ns") {
+            condition.threshold = number;
+        } else if (unit == "us") {
+            condition.threshold = number * 1e3;
+        } else if (unit == "ms") {
+            condition.threshold = number * 1e6;
+        } else if (unit == "s") {
+            condition.threshold = number * 1e9;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (item.compare(0, 5, "gen2>") == 0) {
+        condition.kind = TriggerCondition::Kind::Gen2;
+        return ParseNumber(item.substr(5), condition.threshold, unit) && unit == "/min";
+    }
+    if (item.compare(0, 11, "exceptions>") == 0) {
+        condition.kind = TriggerCondition::Kind::Exceptions;
+        return ParseNumber(item.substr(11), condition.threshold, unit) && unit == "/s";
+    }
+    return false;
+}
+
+bool TriggerCondition::Parse(const std::string& spec, std::vector<TriggerCondition>& conditions) {
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(';', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string item = spec.substr(start, end - start);
+        start = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        TriggerCondition condition;
+        if (!ParseCondition(item, condition)) {
+            printf("Error: invalid trigger %s\n", item.c_str());
+            return false;
+        }
+        conditions.push_back(condition);
+    }
+    return true;
+}
+
+Triggers::Triggers(
+        Profile& profile,
+        TraceWriter& trace,
+        const std::vector<TriggerCondition>& conditions,
+        int intervalSeconds,
+        int captureSeconds,
+        Detail idle,
+        const std::function<void()>& resolveNames
+) :
+    profile(profile),
+    trace(trace),
+    conditions(conditions),
+    intervalSeconds(intervalSeconds),
+    captureSeconds(captureSeconds),
+    idle(idle),
+    resolveNames(resolveNames),
+    stopping(false),
+    gen2(0),
+    exceptions(0)
+{
+}
+
+Triggers::~Triggers()
+{
+    this->Stop();
+}
+
+void Triggers::Start() {
+    this->trace.SetCeiling(this->idle);
+    this->thread = std::thread(&Triggers::Run, this);
+}
+
+void Triggers::Stop() {
+    if (!this->thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->wake.notify_one();
+    }
+    this->thread.join();
+}
+
+const TriggerCondition* Triggers::Evaluate(double seconds, std::string& detail) {
+    const TriggerCondition* fired = nullptr;
+
+    uint64_t gen2 = this->profile.gc.collections[2].load(std::memory_order_relaxed);
+    uint64_t exceptions = this->profile.exceptions.load(std::memory_order_relaxed);
+    double gen2PerMinute = (gen2 - this->gen2) * 60 / seconds;
+    double exceptionsPerSecond = (exceptions - this->exceptions) / seconds;
+    this->gen2 = gen2;
+    this->exceptions = exceptions;
+
+    bool latency = false;
+    for (const TriggerCondition& condition : this->conditions) {
+        if (condition.kind == TriggerCondition::Kind::Latency) {
+            latency = true;
+        } else if (fired == nullptr) {
+            double rate = condition.kind == TriggerCondition::Kind::Gen2 ? gen2PerMinute : exceptionsPerSecond;
+            if (rate > condition.threshold) {
+                fired = &condition;
+                detail = std::to_string(rate);
+            }
+        }
+    }
+    if (!latency) {
+        return fired;
+    }
+
+    this->resolveNames();
+    uint64_t counts[LatencyHistogram::BucketCount];
+    uint64_t delta[LatencyHistogram::BucketCount];
+    for (MethodStats* method : this->profile.methods.List()) {
+        if (!method->HasName()) {
+            continue;
+        }
+        std::string name = method->Name();
+        // Patterns leave out the `Assembly!` prefix of method names.
+        size_t bang = name.find('!');
+        std::string qualified = bang == std::string::npos ? name : name.substr(bang + 1);
+        std::vector<const TriggerCondition*> matched;
+        for (const TriggerCondition& condition : this->conditions) {
+            if (
+                    condition.kind == TriggerCondition::Kind::Latency
+                    && MethodFilter::Glob(condition.pattern, qualified)
+            ) {
+                matched.push_back(&condition);
+            }
+        }
+        if (matched.empty()) {
+            continue;
+        }
+
+        method->latency.Snapshot(counts);
+        std::vector<uint64_t>& previous = this->latencies[method];
+        // The first look has no interval to compare against.
+        bool first = previous.empty();
+        previous.resize(LatencyHistogram::BucketCount);
+        uint64_t total = 0;
+        for (int i = 0; i < LatencyHistogram::BucketCount; i++) {
+            delta[i] = counts[i] - previous[i];
+            total += delta[i];
+            previous[i] = counts[i];
+        }
+        if (first || total == 0 || fired != nullptr) {
+            continue;
+        }
+        uint64_t p99 = LatencyHistogram::Percentile(delta, 0.99);
+        for (const TriggerCondition* condition : matched) {
+            if (p99 > condition->threshold) {
+                fired = condition;
+                detail = name + " p99_ns=" + std::to_string(p99);
+                break;
+            }
+        }
+    }
+    return fired;
+}
+
+void Triggers::Run() {
+    uint64_t captureUntilNs = 0;
+    uint64_t lastNs = NowNs();
+    std::string ignored;
+    this->Evaluate(this->intervalSeconds, ignored);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        bool stopped = this->wake.wait_for(lock, std::chrono::seconds(this->intervalSeconds), [this]() {
+            return this->stopping;
+        });
+        if (stopped) {
+            return;
+        }
+        lock.unlock();
+
+        uint64_t now = NowNs();
+        std::string detail;
+        const TriggerCondition* fired = this->Evaluate((now - lastNs) / 1e9, detail);
+        lastNs = now;
+        if (fired != nullptr) {
+            if (captureUntilNs == 0) {
+                printf("Trigger %s fired (%s), capturing for %d s\n", fired->text.c_str(), detail.c_str(), this->captureSeconds);
+                this->trace.SetCeiling(this->trace.MaxDetail());
+            }
+            captureUntilNs = now + (uint64_t) this->captureSeconds * 1000000000;
+        } else if (captureUntilNs != 0 && now >= captureUntilNs) {
+            printf("Trigger capture over\n");
+            this->trace.SetCeiling(this->idle);
+            captureUntilNs = 0;
+        }
+
+        lock.lock();
+    }
+}
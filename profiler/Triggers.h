@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Profile.h"
+#include "TraceWriter.h"
+
+// A condition checked over each trigger interval, written as one of
+//   p99(Namespace.Type::Method)>50ms  a matching method's p99 latency, with
+//                                     a ns, us, ms or s unit
+//   gen2>5/min                        gen2 collections per minute
+//   exceptions>100/s                  exceptions thrown per second
+// where the method pattern is a glob over `Namespace.Type::Method` names,
+// without the `Assembly!` prefix that `filter` patterns and the profile use.
+struct TriggerCondition
+{
+    enum class Kind
+    {
+        Latency,
+        Gen2,
+        Exceptions,
+    };
+
+    Kind kind;
+    std::string pattern;
+    // Nanoseconds for Latency, events per minute or per second otherwise.
+    double threshold;
+    std::string text;
+
+    // Parses `;`-separated conditions. Returns false, naming the culprit,
+    // on the first one that does not parse.
+    static bool Parse(const std::string& spec, std::vector<TriggerCondition>& conditions);
+};
+
+// Keeps the trace at `idle` detail until a condition holds over an
+// interval, then lets it record at full detail for the capture window. Any
+// condition holding again during the window extends it.
+//
+// The event mask cannot do this: argument and frame capture are fixed at
+// startup, so they are requested up front and the trace's ceiling is what
+// moves.
+class Triggers
+{
+private:
+    Profile& profile;
+    TraceWriter& trace;
+    std::vector<TriggerCondition> conditions;
+    int intervalSeconds;
+    int captureSeconds;
+    Detail idle;
+    std::function<void()> resolveNames;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread thread;
+
+    // Totals at the start of the current interval.
+    std::unordered_map<MethodStats*, std::vector<uint64_t>> latencies;
+    uint64_t gen2;
+    uint64_t exceptions;
+
+    void Run();
+    // Checks every condition against the interval that just ended, and
+    // starts the next one. Returns the first condition that held, or nullptr.
+    const TriggerCondition* Evaluate(double seconds, std::string& detail);
+
+public:
+    // `resolveNames` names the methods the latency conditions are matched
+    // against.
+    Triggers(
+            Profile& profile,
+            TraceWriter& trace,
+            const std::vector<TriggerCondition>& conditions,
+            int intervalSeconds,
+            int captureSeconds,
+            Detail idle,
+            const std::function<void()>& resolveNames
+    );
+    ~Triggers();
+
+    void Start();
+    void Stop();
+};
@@ -16,6 +16,8 @@ printf '  Building %s ... ' "$Output"
 CXX_FLAGS="$CXX_FLAGS --no-undefined -Wno-invalid-noreturn -fPIC -fms-extensions -DBIT64 -DPAL_STDCPP_COMPAT -DPLATFORM_UNIX -std=c++11"
 INCLUDES="-I $CORECLR_PATH/src/pal/inc/rt -I $CORECLR_PATH/src/pal/prebuilt/inc -I $CORECLR_PATH/src/pal/inc -I $CORECLR_PATH/src/inc -I $CORECLR_PATH/bin/Product/$BuildOS.$BuildArch.$BuildType/inc"
 
-clang++ -g -shared -o $Output $CXX_FLAGS $INCLUDES ClassFactory.cpp CorProfiler.cpp dllmain.cpp asmhelpers/amd64/systemv/asmhelpers.S
+SOURCES="ArgumentSketch.cpp ClassFactory.cpp Config.cpp CorProfiler.cpp Coverage.cpp Detacher.cpp HardwareCounters.cpp Lz.cpp Metadata.cpp MethodFilter.cpp ModuleTable.cpp Overhead.cpp Profile.cpp Publisher.cpp Reporter.cpp Symbolizer.cpp ThreadState.cpp TraceCodec.cpp TraceOutput.cpp TraceSink.cpp TraceWriter.cpp Triggers.cpp dllmain.cpp"
+
+clang++ -g -shared -o $Output $CXX_FLAGS $INCLUDES $SOURCES asmhelpers/amd64/systemv/asmhelpers.S -lpthread
 
 printf 'Done.\n'
@@ -0,0 +1,263 @@
+// Collects the profiles that profiler instances push to a Unix domain socket
+// (`aggregator_socket`) and merges them into one host-level profile, written
+// every interval and on SIGINT or SIGTERM, after which it exits.
+//
+//   ProfileAggregator [--interval S] SOCKET OUTPUT
+//
+// Each push is a process's cumulative totals, so it replaces the previous
+// push of the same process, told apart by the `instance` of its profile
+// record rather than its pid, which other processes reuse or, in containers,
+// share. Exited processes keep their last totals, and a push without the
+// profile's closing `end` record was cut off and is dropped. Methods are
+// merged by name and signature hash as ProfileReader keys them. The output
+// is in the profile format, with `pid=0` and the longest uptime seen, so
+// ProfileDiff can compare two of them.
+
+#include "ProfileReader.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Pushes in progress at once; more wait in the listen backlog.
+static const size_t MaxClients = 64;
+
+// A push larger than this is dropped rather than buffered.
+static const size_t MaxPushBytes = 256 << 20;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void OnSignal(int) {
+    stopping = 1;
+}
+
+struct Client
+{
+    int fd;
+    std::string data;
+};
+
+class Aggregator
+{
+private:
+    // The latest push of each running or exited process, by instance.
+    std::map<std::string, Capture> processes;
+    bool changed;
+
+public:
+    Aggregator() : changed(false)
+    {
+    }
+
+    void Add(const std::string& data) {
+        std::istringstream in(data);
+        Capture capture;
+        if (!ReadCapture(in, capture)) {
+            return;
+        }
+        // The publisher gives up mid-send on errors and timeouts, and what
+        // it did send would replace the process's totals with a fraction.
+        if (!capture.complete) {
+            printf("Error: incomplete push from pid %llu dropped\n", (unsigned long long) capture.pid);
+            return;
+        }
+        if (capture.instance.empty()) {
+            printf("Error: push without an instance id from pid %llu dropped\n", (unsigned long long) capture.pid);
+            return;
+        }
+        std::string instance = capture.instance;
+        this->processes[instance] = std::move(capture);
+        this->changed = true;
+    }
+
+    bool Changed() const {
+        return this->changed;
+    }
+
+    bool Write(const std::string& path) {
+        Capture host;
+        host.pid = 0;
+        host.uptimeNs = 0;
+        host.complete = true;
+        for (const auto& process : this->processes) {
+            MergeCapture(host, process.second);
+        }
+
+        // Readers never see a half-written profile.
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary);
+            if (!out) {
+                printf("Error: cannot open %s\n", temporary.c_str());
+                return false;
+            }
+            WriteCapture(out, host);
+            out << "aggregate\tprocesses=" << this->processes.size() << "\n";
+            out << "end\n";
+            if (!out) {
+                printf("Error: cannot write %s\n", temporary.c_str());
+                return false;
+            }
+        }
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            printf("Error: rename %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        this->changed = false;
+        return true;
+    }
+};
+
+static int Listen(const std::string& path) {
+    struct sockaddr_un address;
+    if (path.size() >= sizeof(address.sun_path)) {
+        printf("Error: socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("Error: socket %s\n", strerror(errno));
+        return -1;
+    }
+    // A previous aggregator may have left its socket file behind.
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+        printf("Error: bind %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads what `client` has sent. Returns false once it is done, either at
+// EOF, when its push is handed to `aggregator`, or on error.
+static bool Receive(Client& client, Aggregator& aggregator) {
+    char buffer[65536];
+    ssize_t size = read(client.fd, buffer, sizeof(buffer));
+    if (size < 0) {
+        return errno == EINTR || errno == EAGAIN;
+    }
+    if (size == 0) {
+        aggregator.Add(client.data);
+        return false;
+    }
+    if (client.data.size() + (size_t) size > MaxPushBytes) {
+        printf("Error: push larger than %zu bytes dropped\n", MaxPushBytes);
+        return false;
+    }
+    client.data.append(buffer, (size_t) size);
+    return true;
+}
+
+static uint64_t NowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+static int Usage() {
+    printf("Usage: ProfileAggregator [--interval S] SOCKET OUTPUT\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    int intervalSeconds = 10;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            intervalSeconds = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            return Usage();
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2 || intervalSeconds < 1) {
+        return Usage();
+    }
+
+    int listenFd = Listen(paths[0]);
+    if (listenFd < 0) {
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    Aggregator aggregator;
+    std::vector<Client> clients;
+    uint64_t nextWriteMs = NowMs() + (uint64_t) intervalSeconds * 1000;
+    while (!stopping) {
+        std::vector<struct pollfd> pending;
+        for (const Client& client : clients) {
+            struct pollfd entry;
+            entry.fd = client.fd;
+            entry.events = POLLIN;
+            entry.revents = 0;
+            pending.push_back(entry);
+        }
+        struct pollfd listening;
+        listening.fd = listenFd;
+        listening.events = clients.size() < MaxClients ? POLLIN : 0;
+        listening.revents = 0;
+        pending.push_back(listening);
+
+        uint64_t now = NowMs();
+        int timeoutMs = now >= nextWriteMs ? 0 : (int) (nextWriteMs - now);
+        if (poll(pending.data(), pending.size(), timeoutMs) < 0 && errno != EINTR) {
+            printf("Error: poll %s\n", strerror(errno));
+            break;
+        }
+
+        // Clients are handled before accepting, while `pending` still lines
+        // up with them.
+        std::vector<Client> open;
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (pending[i].revents == 0 || Receive(clients[i], aggregator)) {
+                open.push_back(std::move(clients[i]));
+            } else {
+                close(clients[i].fd);
+            }
+        }
+        clients.swap(open);
+        if ((pending.back().revents & POLLIN) != 0) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                Client client;
+                client.fd = fd;
+                clients.push_back(std::move(client));
+            }
+        }
+
+        if (NowMs() >= nextWriteMs) {
+            if (aggregator.Changed()) {
+                aggregator.Write(paths[1]);
+            }
+            nextWriteMs = NowMs() + (uint64_t) intervalSeconds * 1000;
+        }
+    }
+
+    for (const Client& client : clients) {
+        close(client.fd);
+    }
+    close(listenFd);
+    unlink(paths[0].c_str());
+    return aggregator.Write(paths[1]) ? 0 : 1;
+}
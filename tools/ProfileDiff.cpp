@@ -0,0 +1,361 @@
+// Compares two captures written by the profiler (`profile_path` or the report
+// socket) and prints the methods and classes whose call counts, latency
+// distribution or allocations changed significantly, as tab-separated
+// `key=value` records like the profile itself. Allocations are compared by
+// object count, and by bytes when both captures have them.
+//
+//   ProfileDiff [--alpha 0.001] [--raw] [--threads N] before.txt after.txt
+//
+// Counts are compared as rates over each capture's uptime unless --raw is
+// given, for captures of the same fixed workload.
+
+#include "ProfileReader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fewest records worth handing to a merge thread of their own.
+static const size_t MinPartitionSize = 4096;
+
+struct Options
+{
+    double alpha;
+    bool raw;
+    unsigned threads;
+};
+
+enum Verdict
+{
+    Same,
+    Changed,
+    Added,
+    Removed,
+    VerdictCount,
+};
+
+struct Part
+{
+    std::string text;
+    size_t counts[VerdictCount];
+};
+
+// Two-sided p-value of a standard normal deviate.
+static double NormalPValue(double z) {
+    return erfc(fabs(z) / sqrt(2.0));
+}
+
+// Tests whether two Poisson counts observed over the given exposures have the
+// same rate. Conditioned on their sum, the second count is binomial, which is
+// approximated by a normal here.
+static double PoissonTest(uint64_t before, double beforeExposure, uint64_t after, double afterExposure) {
+    double total = (double) before + (double) after;
+    double share = afterExposure / (beforeExposure + afterExposure);
+    double variance = total * share * (1 - share);
+    if (variance == 0) {
+        return 1.0;
+    }
+    return NormalPValue(((double) after - total * share) / sqrt(variance));
+}
+
+// Two-sample Kolmogorov-Smirnov test over histograms with the same buckets.
+// Returns the p-value and sets `distance` to the largest gap between the two
+// cumulative distributions.
+static double KsTest(const std::vector<uint64_t>& before, const std::vector<uint64_t>& after, double& distance) {
+    double beforeTotal = 0;
+    double afterTotal = 0;
+    for (size_t i = 0; i < before.size(); i++) {
+        beforeTotal += (double) before[i];
+        afterTotal += (double) after[i];
+    }
+    distance = 0;
+    if (beforeTotal == 0 || afterTotal == 0) {
+        return 1.0;
+    }
+
+    double beforeSum = 0;
+    double afterSum = 0;
+    for (size_t i = 0; i < before.size(); i++) {
+        beforeSum += (double) before[i];
+        afterSum += (double) after[i];
+        distance = std::max(distance, fabs(beforeSum / beforeTotal - afterSum / afterTotal));
+    }
+
+    // Asymptotic Kolmogorov distribution, with Stephens' small-sample
+    // correction.
+    double effective = sqrt(beforeTotal * afterTotal / (beforeTotal + afterTotal));
+    double lambda = (effective + 0.12 + 0.11 / effective) * distance;
+    if (lambda < 0.2) {
+        return 1.0;
+    }
+    double p = 0;
+    for (int k = 1; k <= 100; k++) {
+        double term = exp(-2.0 * k * k * lambda * lambda);
+        p += (k % 2 == 1 ? 2.0 : -2.0) * term;
+        if (term < 1e-12) {
+            break;
+        }
+    }
+    return std::min(std::max(p, 0.0), 1.0);
+}
+
+// Tests allocated bytes as PoissonTest does counts, in units of the mean
+// object size of both captures together, as bytes come in objects rather
+// than one at a time.
+static double VolumeTest(const AllocationProfile& before, double beforeExposure, const AllocationProfile& after, double afterExposure) {
+    double objects = (double) before.objects + (double) after.objects;
+    if (objects == 0) {
+        return 1.0;
+    }
+    double meanSize = ((double) before.bytes + (double) after.bytes) / objects;
+    if (meanSize == 0) {
+        return 1.0;
+    }
+    return PoissonTest(
+            (uint64_t) llround(before.bytes / meanSize),
+            beforeExposure,
+            (uint64_t) llround(after.bytes / meanSize),
+            afterExposure
+    );
+}
+
+static std::string Change(uint64_t before, double beforeExposure, uint64_t after, double afterExposure) {
+    if (before == 0) {
+        return "inf";
+    }
+    double ratio = ((double) after / afterExposure) / ((double) before / beforeExposure);
+    char text[32];
+    snprintf(text, sizeof(text), "%+.1f%%", (ratio - 1) * 100);
+    return text;
+}
+
+class Comparer
+{
+private:
+    const Options& options;
+    double beforeExposure;
+    double afterExposure;
+
+public:
+    Comparer(const Options& options, const Capture& before, const Capture& after) :
+        options(options),
+        beforeExposure(options.raw ? 1.0 : (double) before.uptimeNs),
+        afterExposure(options.raw ? 1.0 : (double) after.uptimeNs)
+    {
+    }
+
+    Verdict Compare(const MethodProfile* before, const MethodProfile* after, std::ostringstream& out) const {
+        if (before == nullptr) {
+            out << "added\tmethod=" << after->key << "\tcalls=" << after->calls << "\n";
+            return Added;
+        }
+        if (after == nullptr) {
+            out << "removed\tmethod=" << before->key << "\tcalls=" << before->calls << "\n";
+            return Removed;
+        }
+
+        double callsP = PoissonTest(before->calls, this->beforeExposure, after->calls, this->afterExposure);
+        double distance;
+        double latencyP = KsTest(before->histogram, after->histogram, distance);
+        if (callsP >= this->options.alpha && latencyP >= this->options.alpha) {
+            return Same;
+        }
+
+        out << "method\tname=" << before->key
+            << "\tcalls=" << before->calls << "->" << after->calls
+            << "\tcalls_change=" << Change(before->calls, this->beforeExposure, after->calls, this->afterExposure)
+            << "\tcalls_p=" << callsP
+            << "\tp50_ns=" << before->Percentile(0.50) << "->" << after->Percentile(0.50)
+            << "\tp90_ns=" << before->Percentile(0.90) << "->" << after->Percentile(0.90)
+            << "\tp99_ns=" << before->Percentile(0.99) << "->" << after->Percentile(0.99)
+            << "\tlatency_d=" << distance
+            << "\tlatency_p=" << latencyP
+            << "\n";
+        return Changed;
+    }
+
+    Verdict Compare(const AllocationProfile* before, const AllocationProfile* after, std::ostringstream& out) const {
+        if (before == nullptr) {
+            out << "added\tclass=" << after->className << "\tobjects=" << after->objects;
+            if (after->bytes != 0) {
+                out << "\tbytes=" << after->bytes;
+            }
+            out << "\n";
+            return Added;
+        }
+        if (after == nullptr) {
+            out << "removed\tclass=" << before->className << "\tobjects=" << before->objects;
+            if (before->bytes != 0) {
+                out << "\tbytes=" << before->bytes;
+            }
+            out << "\n";
+            return Removed;
+        }
+
+        double p = PoissonTest(before->objects, this->beforeExposure, after->objects, this->afterExposure);
+        bool volume = before->bytes != 0 && after->bytes != 0;
+        double bytesP = volume ? VolumeTest(*before, this->beforeExposure, *after, this->afterExposure) : 1.0;
+        if (p >= this->options.alpha && bytesP >= this->options.alpha) {
+            return Same;
+        }
+        out << "alloc\tclass=" << before->className
+            << "\tobjects=" << before->objects << "->" << after->objects
+            << "\tchange=" << Change(before->objects, this->beforeExposure, after->objects, this->afterExposure)
+            << "\tp=" << p;
+        if (volume) {
+            out << "\tbytes=" << before->bytes << "->" << after->bytes
+                << "\tbytes_change=" << Change(before->bytes, this->beforeExposure, after->bytes, this->afterExposure)
+                << "\tbytes_p=" << bytesP;
+        }
+        out << "\n";
+        return Changed;
+    }
+};
+
+// Merge-joins two tables sorted by `key`. The key space is cut at evenly
+// spaced keys of `before` and each range is merged by its own thread; the
+// parts come back in key order.
+template <typename T, typename Key>
+static std::vector<Part> ParallelMerge(
+        const std::vector<T>& before,
+        const std::vector<T>& after,
+        Key key,
+        const Comparer& comparer,
+        unsigned threads
+) {
+    size_t partitions = std::max<size_t>(1, std::min<size_t>(threads, before.size() / MinPartitionSize));
+    std::vector<size_t> beforeBounds(partitions + 1);
+    std::vector<size_t> afterBounds(partitions + 1);
+    beforeBounds[partitions] = before.size();
+    afterBounds[partitions] = after.size();
+    for (size_t i = 1; i < partitions; i++) {
+        beforeBounds[i] = i * before.size() / partitions;
+        afterBounds[i] = std::lower_bound(after.begin(), after.end(), key(before[beforeBounds[i]]), [&](const T& item, const std::string& split) {
+            return key(item) < split;
+        }) - after.begin();
+    }
+
+    std::vector<Part> parts(partitions);
+    auto merge = [&](size_t index) {
+        std::ostringstream out;
+        out.precision(3);
+        Part& part = parts[index];
+        std::fill(part.counts, part.counts + VerdictCount, 0);
+        size_t b = beforeBounds[index];
+        size_t a = afterBounds[index];
+        while (b < beforeBounds[index + 1] || a < afterBounds[index + 1]) {
+            Verdict verdict;
+            if (a == afterBounds[index + 1] || (b < beforeBounds[index + 1] && key(before[b]) < key(after[a]))) {
+                verdict = comparer.Compare(&before[b++], nullptr, out);
+            } else if (b == beforeBounds[index + 1] || key(after[a]) < key(before[b])) {
+                verdict = comparer.Compare(nullptr, &after[a++], out);
+            } else {
+                verdict = comparer.Compare(&before[b++], &after[a++], out);
+            }
+            part.counts[verdict]++;
+        }
+        part.text = out.str();
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < partitions; i++) {
+        workers.push_back(std::thread(merge, i));
+    }
+    merge(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return parts;
+}
+
+static void Print(const std::vector<Part>& parts, size_t counts[VerdictCount]) {
+    std::fill(counts, counts + VerdictCount, 0);
+    for (const Part& part : parts) {
+        fwrite(part.text.data(), 1, part.text.size(), stdout);
+        for (int i = 0; i < VerdictCount; i++) {
+            counts[i] += part.counts[i];
+        }
+    }
+}
+
+static int Usage() {
+    printf("Usage: ProfileDiff [--alpha P] [--raw] [--threads N] BEFORE AFTER\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    options.alpha = 0.001;
+    options.raw = false;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) {
+            options.alpha = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--raw") == 0) {
+            options.raw = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = std::max(1, atoi(argv[++i]));
+        } else if (argv[i][0] == '-') {
+            return Usage();
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2 || !(options.alpha > 0 && options.alpha < 1)) {
+        return Usage();
+    }
+
+    Capture before;
+    Capture after;
+    bool beforeRead = false;
+    std::thread reader([&]() {
+        beforeRead = ReadCaptureFile(paths[0], before);
+    });
+    bool afterRead = ReadCaptureFile(paths[1], after);
+    reader.join();
+    if (!beforeRead || !afterRead) {
+        return 1;
+    }
+    if (!options.raw && (before.uptimeNs == 0 || after.uptimeNs == 0)) {
+        printf("Error: capture without uptime, use --raw\n");
+        return 1;
+    }
+
+    printf(
+            "diff\tbefore_uptime_ns=%llu\tafter_uptime_ns=%llu\talpha=%g\n",
+            (unsigned long long) before.uptimeNs,
+            (unsigned long long) after.uptimeNs,
+            options.alpha
+    );
+
+    Comparer comparer(options, before, after);
+    size_t methods[VerdictCount];
+    Print(ParallelMerge(before.methods, after.methods, [](const MethodProfile& method) -> const std::string& {
+        return method.key;
+    }, comparer, options.threads), methods);
+    size_t classes[VerdictCount];
+    Print(ParallelMerge(before.allocations, after.allocations, [](const AllocationProfile& allocation) -> const std::string& {
+        return allocation.className;
+    }, comparer, options.threads), classes);
+
+    printf(
+            "summary\tmethods=%zu\tmethods_changed=%zu\tmethods_added=%zu\tmethods_removed=%zu"
+            "\tclasses=%zu\tclasses_changed=%zu\tclasses_added=%zu\tclasses_removed=%zu\n",
+            methods[Same] + methods[Changed],
+            methods[Changed],
+            methods[Added],
+            methods[Removed],
+            classes[Same] + classes[Changed],
+            classes[Changed],
+            classes[Added],
+            classes[Removed]
+    );
+    return 0;
+}
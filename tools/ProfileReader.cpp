@@ -0,0 +1,223 @@
+#include "ProfileReader.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+MethodProfile::MethodProfile() :
+    calls(0),
+    totalNs(0),
+    maxNs(0),
+    histogram(LatencyHistogram::BucketCount, 0)
+{
+}
+
+uint64_t MethodProfile::Percentile(double quantile) const {
+    return std::min(LatencyHistogram::Percentile(this->histogram.data(), quantile), this->maxNs);
+}
+
+static void MergeMethod(MethodProfile& into, const MethodProfile& from) {
+    into.calls += from.calls;
+    into.totalNs += from.totalNs;
+    into.maxNs = std::max(into.maxNs, from.maxNs);
+    for (int b = 0; b < LatencyHistogram::BucketCount; b++) {
+        into.histogram[b] += from.histogram[b];
+    }
+}
+
+// Splits a `kind\tkey=value\t...` line into its kind and fields.
+static std::string ParseLine(const std::string& line, std::map<std::string, std::string>& fields) {
+    size_t start = line.find('\t');
+    std::string kind = line.substr(0, start);
+    while (start != std::string::npos) {
+        size_t end = line.find('\t', start + 1);
+        std::string field = line.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+        size_t equals = field.find('=');
+        if (equals != std::string::npos) {
+            fields[field.substr(0, equals)] = field.substr(equals + 1);
+        }
+        start = end;
+    }
+    return kind;
+}
+
+static uint64_t Number(const std::map<std::string, std::string>& fields, const char* key) {
+    auto found = fields.find(key);
+    return found == fields.end() ? 0 : strtoull(found->second.c_str(), nullptr, 10);
+}
+
+// Parses sparse `bucket:count,...` pairs.
+static void ParseHistogram(const std::string& text, std::vector<uint64_t>& histogram) {
+    const char* cursor = text.c_str();
+    while (*cursor != '\0') {
+        char* end;
+        long bucket = strtol(cursor, &end, 10);
+        if (*end != ':') {
+            return;
+        }
+        uint64_t count = strtoull(end + 1, &end, 10);
+        if (bucket >= 0 && bucket < LatencyHistogram::BucketCount) {
+            histogram[bucket] += count;
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    }
+}
+
+bool ReadCapture(std::istream& in, Capture& capture) {
+    capture.pid = 0;
+    capture.instance.clear();
+    capture.uptimeNs = 0;
+    capture.complete = false;
+    capture.methods.clear();
+    capture.allocations.clear();
+
+    bool header = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::map<std::string, std::string> fields;
+        std::string kind = ParseLine(line, fields);
+        if (kind == "profile") {
+            header = true;
+            capture.pid = Number(fields, "pid");
+            capture.instance = fields["instance"];
+            capture.uptimeNs = Number(fields, "uptime_ns");
+        } else if (kind == "method") {
+            MethodProfile method;
+            method.key = fields["name"] + "#" + fields["sig"];
+            method.calls = Number(fields, "calls");
+            method.totalNs = Number(fields, "total_ns");
+            method.maxNs = Number(fields, "max_ns");
+            ParseHistogram(fields["hist"], method.histogram);
+            capture.methods.push_back(std::move(method));
+        } else if (kind == "alloc") {
+            AllocationProfile allocation;
+            allocation.className = fields["class"];
+            allocation.objects = Number(fields, "objects");
+            allocation.bytes = Number(fields, "bytes");
+            capture.allocations.push_back(allocation);
+        } else if (kind == "end") {
+            capture.complete = true;
+        }
+    }
+    if (!header) {
+        printf("Error: not a profile, no profile record\n");
+        return false;
+    }
+
+    std::sort(capture.methods.begin(), capture.methods.end(), [](const MethodProfile& a, const MethodProfile& b) {
+        return a.key < b.key;
+    });
+    size_t kept = 0;
+    for (size_t i = 0; i < capture.methods.size(); i++) {
+        if (kept != 0 && capture.methods[kept - 1].key == capture.methods[i].key) {
+            MergeMethod(capture.methods[kept - 1], capture.methods[i]);
+        } else {
+            if (kept != i) {
+                capture.methods[kept] = std::move(capture.methods[i]);
+            }
+            kept++;
+        }
+    }
+    capture.methods.resize(kept);
+
+    std::sort(capture.allocations.begin(), capture.allocations.end(), [](const AllocationProfile& a, const AllocationProfile& b) {
+        return a.className < b.className;
+    });
+    kept = 0;
+    for (size_t i = 0; i < capture.allocations.size(); i++) {
+        if (kept != 0 && capture.allocations[kept - 1].className == capture.allocations[i].className) {
+            capture.allocations[kept - 1].objects += capture.allocations[i].objects;
+            capture.allocations[kept - 1].bytes += capture.allocations[i].bytes;
+        } else {
+            capture.allocations[kept++] = capture.allocations[i];
+        }
+    }
+    capture.allocations.resize(kept);
+    return true;
+}
+
+bool ReadCaptureFile(const std::string& path, Capture& capture) {
+    std::ifstream in(path);
+    if (!in) {
+        printf("Error: cannot open %s\n", path.c_str());
+        return false;
+    }
+    return ReadCapture(in, capture);
+}
+
+void MergeCapture(Capture& into, const Capture& from) {
+    into.uptimeNs = std::max(into.uptimeNs, from.uptimeNs);
+
+    std::vector<MethodProfile> methods;
+    methods.reserve(into.methods.size() + from.methods.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < into.methods.size() || j < from.methods.size()) {
+        if (j == from.methods.size() || (i < into.methods.size() && into.methods[i].key < from.methods[j].key)) {
+            methods.push_back(std::move(into.methods[i++]));
+        } else if (i == into.methods.size() || from.methods[j].key < into.methods[i].key) {
+            methods.push_back(from.methods[j++]);
+        } else {
+            methods.push_back(std::move(into.methods[i++]));
+            MergeMethod(methods.back(), from.methods[j++]);
+        }
+    }
+    into.methods.swap(methods);
+
+    std::vector<AllocationProfile> allocations;
+    allocations.reserve(into.allocations.size() + from.allocations.size());
+    i = 0;
+    j = 0;
+    while (i < into.allocations.size() || j < from.allocations.size()) {
+        if (
+                j == from.allocations.size()
+                || (i < into.allocations.size() && into.allocations[i].className < from.allocations[j].className)
+        ) {
+            allocations.push_back(into.allocations[i++]);
+        } else if (i == into.allocations.size() || from.allocations[j].className < into.allocations[i].className) {
+            allocations.push_back(from.allocations[j++]);
+        } else {
+            allocations.push_back(into.allocations[i++]);
+            allocations.back().objects += from.allocations[j].objects;
+            allocations.back().bytes += from.allocations[j++].bytes;
+        }
+    }
+    into.allocations.swap(allocations);
+}
+
+void WriteCapture(std::ostream& out, const Capture& capture) {
+    out << "profile\tpid=" << capture.pid;
+    if (!capture.instance.empty()) {
+        out << "\tinstance=" << capture.instance;
+    }
+    out << "\tuptime_ns=" << capture.uptimeNs << "\n";
+    for (const MethodProfile& method : capture.methods) {
+        // The key is `name#sig`, and names may hold a `#` of their own.
+        size_t hash = method.key.rfind('#');
+        out << "method\tname=" << method.key.substr(0, hash)
+            << "\tsig=" << (hash == std::string::npos ? std::string() : method.key.substr(hash + 1))
+            << "\tcalls=" << method.calls
+            << "\ttotal_ns=" << method.totalNs
+            << "\tp50_ns=" << method.Percentile(0.50)
+            << "\tp90_ns=" << method.Percentile(0.90)
+            << "\tp99_ns=" << method.Percentile(0.99)
+            << "\tmax_ns=" << method.maxNs
+            << "\thist=";
+        bool first = true;
+        for (int b = 0; b < LatencyHistogram::BucketCount; b++) {
+            if (method.histogram[b] != 0) {
+                out << (first ? "" : ",") << b << ":" << method.histogram[b];
+                first = false;
+            }
+        }
+        out << "\n";
+    }
+    for (const AllocationProfile& allocation : capture.allocations) {
+        out << "alloc\tclass=" << allocation.className << "\tobjects=" << allocation.objects;
+        if (allocation.bytes != 0) {
+            out << "\tbytes=" << allocation.bytes;
+        }
+        out << "\n";
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Histogram.h"
+
+// A `method` record of a profile, keyed by its stable identity: the
+// `assembly!Type::Method` name and the signature hash, which survive restarts
+// where FunctionIDs and tokens do not. Generic instantiations share a key and
+// are merged into one record.
+struct MethodProfile
+{
+    std::string key;
+    uint64_t calls;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    std::vector<uint64_t> histogram;
+
+    MethodProfile();
+
+    uint64_t Percentile(double quantile) const;
+};
+
+// An `alloc` record: objects allocated per class name, and their bytes when
+// the profiler saw every allocation, 0 otherwise.
+struct AllocationProfile
+{
+    std::string className;
+    uint64_t objects;
+    uint64_t bytes;
+};
+
+// One capture of the profiler's output (see FormatProfile), with methods and
+// allocations sorted by key and duplicates merged, ready for merge joins.
+struct Capture
+{
+    uint64_t pid;
+    // The profiler's id for the process, unique where pids are not; empty
+    // in merged captures and those of older profilers.
+    std::string instance;
+    uint64_t uptimeNs;
+    // Whether the `end` record was read, so that nothing was cut off.
+    bool complete;
+    std::vector<MethodProfile> methods;
+    std::vector<AllocationProfile> allocations;
+};
+
+bool ReadCapture(std::istream& in, Capture& capture);
+
+bool ReadCaptureFile(const std::string& path, Capture& capture);
+
+// Adds the methods and allocations of `from` to `into`, keeping them sorted
+// and keyed as ReadCapture leaves them. The uptime becomes the longer of
+// the two; the pid and instance are left alone.
+void MergeCapture(Capture& into, const Capture& from);
+
+// Writes `capture` back in the profiler's format, `method` and `alloc`
+// records only, so that ReadCapture and the tools reading profiles take it.
+void WriteCapture(std::ostream& out, const Capture& capture);
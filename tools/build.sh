@@ -0,0 +1,12 @@
+#!/bin/sh
+
+CXX_FLAGS="$CXX_FLAGS -O2 -std=c++11"
+INCLUDES="-I ../profiler"
+
+printf '  Building ProfileDiff ... '
+clang++ -g -o ProfileDiff $CXX_FLAGS $INCLUDES ProfileDiff.cpp ProfileReader.cpp -lpthread
+printf 'Done.\n'
+
+printf '  Building ProfileAggregator ... '
+clang++ -g -o ProfileAggregator $CXX_FLAGS $INCLUDES ProfileAggregator.cpp ProfileReader.cpp
+printf 'Done.\n'